@@ -0,0 +1,296 @@
+/*****************************************************************************/
+/*                                                                           */
+/*! @brief Bandwidth benchmark: read()/write() of /dev/dmatest against      */
+/*         direct access to the mapped buffer of /dev/dmatest_user           */
+/*                                                                           */
+/*---------------------------------------------------------------------------*/
+/*! @file   dma-bench.c                                                      */
+/*! @author Ulrich Becker                                                    */
+/*! @date   18.10.2026                                                       */
+/*****************************************************************************/
+/*! @note Both drivers have to be loaded, preferably with the same buffer
+ *        size, e.g.:
+ *! @code
+ * insmod dmatest.ko bufferSize=67108864
+ * insmod dmatest-user.ko bufferSize=67108864
+ * ./dmabench -t 8 > result.csv
+ *! @endcode
+ * The result is a CSV table on stdout, one line per measurement:
+ * path (rw or mmap), operation (write or read), block size in bytes,
+ * number of threads and bandwidth in MiB/s.
+ * With the read()/write() path each thread transfers its own region of
+ * the buffer by pwrite()/pread() in blocks, with the mmap path it copies
+ * its region block by block by memcpy().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <dma_test_ctl.h>
+#include <dma_test_user_ctl.h>
+
+#define RW_DEVICE   "/dev/" DMATEST_DEVICE_NAME
+#define MMAP_DEVICE "/dev/" DMATEST_USER_DEVICE_NAME
+#define SYSFS_DIR   "/sys/class/misc/"
+
+#define MIN_BLOCK_SIZE 4096
+#define MAX_THREADS    64
+
+typedef enum
+{
+   PATH_RW,
+   PATH_MMAP
+} PATH_T;
+
+/*!
+ * @brief Job of one thread.
+ */
+typedef struct
+{
+   pthread_t  thread;
+   PATH_T     path;
+   bool       write;
+   int        fd;
+   uint8_t*   pMap;
+   off_t      offset;
+   size_t     length;
+   size_t     blockSize;
+   unsigned   passes;
+   uint8_t*   pBlock;
+   int        error;
+} JOB_T;
+
+/*!----------------------------------------------------------------------------
+ */
+static double getTime( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns the buffer size of the given driver from sysfs or 0.
+ */
+static size_t getBufferSize( const char* pDeviceName )
+{
+   char path[128];
+   unsigned long size = 0;
+   snprintf( path, sizeof( path ), SYSFS_DIR "%s/size", pDeviceName );
+   FILE* pFile = fopen( path, "r" );
+   if( pFile == NULL )
+      return 0;
+   if( fscanf( pFile, "%lu", &size ) != 1 )
+      size = 0;
+   fclose( pFile );
+   return size;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Thread function: transfers the region of the job block by block.
+ */
+static void* threadFunction( void* pArg )
+{
+   JOB_T* pJob = pArg;
+
+   for( unsigned int pass = 0; pass < pJob->passes; pass++ )
+   {
+      for( size_t done = 0; done < pJob->length; done += pJob->blockSize )
+      {
+         const size_t n = (pJob->length - done < pJob->blockSize)?
+                          (pJob->length - done) : pJob->blockSize;
+         const off_t offset = pJob->offset + done;
+
+         if( pJob->path == PATH_MMAP )
+         {
+            if( pJob->write )
+               memcpy( pJob->pMap + offset, pJob->pBlock, n );
+            else
+               memcpy( pJob->pBlock, pJob->pMap + offset, n );
+            continue;
+         }
+
+         const ssize_t ret = pJob->write? pwrite( pJob->fd, pJob->pBlock, n, offset ) :
+                                          pread( pJob->fd, pJob->pBlock, n, offset );
+         if( ret != (ssize_t)n )
+         {
+            pJob->error = (ret < 0)? errno : EIO;
+            return NULL;
+         }
+      }
+   }
+   return NULL;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Runs one measurement and prints its CSV line.
+ */
+static int measure( PATH_T path, bool write, int fd, uint8_t* pMap, size_t size,
+                    size_t blockSize, unsigned int numThreads, unsigned int passes )
+{
+   JOB_T jobs[MAX_THREADS];
+   const size_t region = (size / numThreads) & ~(size_t)(MIN_BLOCK_SIZE - 1);
+   int ret = 0;
+
+   if( region < blockSize )
+      return 0;
+
+   for( unsigned int i = 0; i < numThreads; i++ )
+   {
+      jobs[i] = (JOB_T){ .path = path, .write = write, .fd = fd, .pMap = pMap,
+                         .offset = i * region, .length = region,
+                         .blockSize = blockSize, .passes = passes };
+      jobs[i].pBlock = malloc( blockSize );
+      if( jobs[i].pBlock == NULL )
+      {
+         fprintf( stderr, "ERROR: Unable to allocate %zu bytes!\n", blockSize );
+         for( unsigned int j = 0; j < i; j++ )
+            free( jobs[j].pBlock );
+         return -1;
+      }
+      memset( jobs[i].pBlock, (int)i, blockSize );
+   }
+
+   unsigned int started = 0;
+   const double start = getTime();
+   while( started < numThreads )
+   {
+      if( pthread_create( &jobs[started].thread, NULL, threadFunction, &jobs[started] ) != 0 )
+      {
+         fprintf( stderr, "ERROR: pthread_create\n" );
+         ret = -1;
+         break;
+      }
+      started++;
+   }
+   for( unsigned int i = 0; i < started; i++ )
+      pthread_join( jobs[i].thread, NULL );
+   const double elapsed = getTime() - start;
+
+   for( unsigned int i = 0; i < numThreads; i++ )
+   {
+      if( jobs[i].error != 0 )
+      {
+         fprintf( stderr, "ERROR: %s\n", strerror( jobs[i].error ) );
+         ret = -1;
+      }
+      free( jobs[i].pBlock );
+   }
+
+   if( ret == 0 )
+   {
+      const double megaBytes = (double)region * numThreads * passes / (1024.0 * 1024.0);
+      printf( "%s,%s,%zu,%u,%.1f\n", (path == PATH_MMAP)? "mmap" : "rw",
+              write? "write" : "read", blockSize, numThreads, megaBytes / elapsed );
+      fflush( stdout );
+   }
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Runs the sweep over block sizes and thread counts for one path.
+ */
+static int sweep( PATH_T path, int fd, uint8_t* pMap, size_t size,
+                  size_t maxBlockSize, unsigned int maxThreads, unsigned int passes )
+{
+   for( size_t blockSize = MIN_BLOCK_SIZE; blockSize <= maxBlockSize; blockSize *= 4 )
+   {
+      for( unsigned int numThreads = 1; numThreads <= maxThreads; numThreads *= 2 )
+      {
+         if( measure( path, true, fd, pMap, size, blockSize, numThreads, passes ) != 0 )
+            return -1;
+         if( measure( path, false, fd, pMap, size, blockSize, numThreads, passes ) != 0 )
+            return -1;
+      }
+   }
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void printHelp( const char* pProgramName )
+{
+   printf( "Usage: %s [options]\n"
+           "Options:\n"
+           "  -b <bytes>  Largest block size, default: 4194304.\n"
+           "  -t <count>  Largest number of threads, default: 4, maximum: %d.\n"
+           "  -p <count>  Passes over the buffer per measurement, default: 10.\n"
+           "  -h          This help.\n", pProgramName, MAX_THREADS );
+}
+
+int main( int argc, char** argv )
+{
+   size_t maxBlockSize = 4 * 1024 * 1024;
+   unsigned int maxThreads = 4;
+   unsigned int passes = 10;
+   int opt;
+
+   while( (opt = getopt( argc, argv, "b:t:p:h" )) != -1 )
+   {
+      switch( opt )
+      {
+         case 'b': maxBlockSize = strtoul( optarg, NULL, 0 ); break;
+         case 't': maxThreads = (unsigned int)atoi( optarg ); break;
+         case 'p': passes = (unsigned int)atoi( optarg ); break;
+         case 'h': printHelp( argv[0] ); return EXIT_SUCCESS;
+         default:  printHelp( argv[0] ); return EXIT_FAILURE;
+      }
+   }
+   if( (maxThreads == 0) || (maxThreads > MAX_THREADS) || (passes == 0) )
+   {
+      printHelp( argv[0] );
+      return EXIT_FAILURE;
+   }
+
+   printf( "path,operation,block_size,threads,mib_per_s\n" );
+
+   int ret = EXIT_SUCCESS;
+   size_t size = getBufferSize( DMATEST_DEVICE_NAME );
+   int fd = open( RW_DEVICE, O_RDWR );
+   if( (fd < 0) || (size == 0) )
+   {
+      fprintf( stderr, "ERROR: Can't open: " RW_DEVICE "\n" );
+      if( fd >= 0 )
+         close( fd );
+      ret = EXIT_FAILURE;
+   }
+   else
+   {
+      if( sweep( PATH_RW, fd, NULL, size, maxBlockSize, maxThreads, passes ) != 0 )
+         ret = EXIT_FAILURE;
+      close( fd );
+   }
+
+   size = getBufferSize( DMATEST_USER_DEVICE_NAME );
+   fd = open( MMAP_DEVICE, O_RDWR );
+   if( (fd < 0) || (size == 0) )
+   {
+      fprintf( stderr, "ERROR: Can't open: " MMAP_DEVICE "\n" );
+      if( fd >= 0 )
+         close( fd );
+      return EXIT_FAILURE;
+   }
+   uint8_t* pMap = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+   if( pMap == MAP_FAILED )
+   {
+      fprintf( stderr, "ERROR: Can't make memory-map of " MMAP_DEVICE "\n" );
+      close( fd );
+      return EXIT_FAILURE;
+   }
+   if( sweep( PATH_MMAP, fd, pMap, size, maxBlockSize, maxThreads, passes ) != 0 )
+      ret = EXIT_FAILURE;
+   munmap( pMap, size );
+   close( fd );
+
+   return ret;
+}
+
+/*================================== EOF ====================================*/
@@ -15,9 +15,42 @@
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/dma-mapping.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/scatterlist.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#include <dma_test_ctl.h>
 
 MODULE_LICENSE( "GPL" );
 
+/*!
+ * @brief Size of the DMA buffer in bytes, becomes rounded up to whole pages.
+ *
+ * The buffer becomes allocated physically contiguous, large buffers come
+ * from the CMA area (kernel parameter cma=...). If no contiguous memory is
+ * available, the buffer becomes allocated in chunks described by a
+ * scatter-gather list.
+ * @see /sys/class/misc/dmatest/layout
+ */
+static unsigned long bufferSize = 4096;
+module_param( bufferSize, ulong, 0444 );
+MODULE_PARM_DESC( bufferSize, "Size of the DMA buffer in bytes" );
+
+/*!
+ * @brief Allocates normal cacheable memory and maps it by dma_map_single()
+ *        instead of dma_alloc_coherent().
+ *
+ * On platforms without cache coherent DMA, coherent memory is uncached and
+ * slow for the CPU. Cacheable memory needs explicit synchronization which
+ * read() and write() do for the accessed range.
+ */
+static bool streaming = false;
+module_param( streaming, bool, 0444 );
+MODULE_PARM_DESC( streaming, "Cacheable memory mapped by dma_map_single() instead of coherent memory" );
+
 #define CONFIG_DEBUG_SKELETON
 #define DEVICE_BASE_FILE_NAME KBUILD_MODNAME
 
@@ -45,19 +78,418 @@ MODULE_LICENSE( "GPL" );
 /* End of message helper macros for "dmesg" ++++++++***************************/
 
 
-#define DMA_BUFFER_SIZE 4096
+/*!
+ * @brief Largest chunk in layout LAYOUT_CHUNKED, chunks which can't be
+ *        allocated become halved down to one page.
+ */
+#define DMA_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef enum
+{
+   /*! @brief One coherent buffer, from the CMA area when it is large. */
+   LAYOUT_CONTIGUOUS = 0,
+   /*! @brief Chunks of cacheable pages from dma_alloc_pages(). */
+   LAYOUT_CHUNKED    = 1,
+   /*! @brief One buffer of cacheable pages mapped by dma_map_single(). */
+   LAYOUT_STREAMING  = 2
+} LAYOUT_T;
+
+/*!
+ * @brief Chunk during the allocation in layout LAYOUT_CHUNKED.
+ */
+typedef struct
+{
+   struct page* pPage;
+   dma_addr_t   dmaAddr;
+   size_t       size;
+} CHUNK_T;
+
+/*!
+ * @brief Maximum length of a single zero-copy write.
+ * @see DMATEST_IOCTL_WRITE_SG
+ */
+#define DMA_SG_MAX_LENGTH (256 * 1024 * 1024)
 
 
 struct GLOBAL_T
 {
-   void*          pDmaVirt;
-   dma_addr_t     pDmaPhys;
-   struct device* pDev;
+   void*           pDmaVirt;
+   dma_addr_t      pDmaPhys;
+   struct device*  pDev;
+   size_t          size;
+   LAYOUT_T        layout;
+   /*!
+    * @brief Chunks of the buffer in layout LAYOUT_CHUNKED, each entry
+    *        contains the page and the DMA address of a chunk.
+    */
+   struct sg_table sgTable;
+   /*!
+    * @brief Byte ranges of the buffer which are currently accessed,
+    *        protected by rangeLock.
+    * @see rangeLock()
+    */
+   struct list_head  rangeList;
+   spinlock_t        rangeLock;
+   wait_queue_head_t rangeWaitQueue;
 };
 
+/*!
+ * @brief Byte range of the buffer locked by a read or write.
+ */
+typedef struct
+{
+   struct list_head entry;
+   loff_t           start;
+   loff_t           end;
+   bool             write;
+} RANGE_T;
+
 static struct GLOBAL_T global;
 
 /*!----------------------------------------------------------------------------
+ * @brief Frees the chunks of the buffer in layout LAYOUT_CHUNKED.
+ */
+static void bufferFreeChunks( void )
+{
+   struct scatterlist* pSg;
+   int i;
+
+   for_each_sgtable_sg( &global.sgTable, pSg, i )
+   {
+      dma_free_pages( global.pDev, pSg->length, sg_page( pSg ),
+                      sg_dma_address( pSg ), DMA_BIDIRECTIONAL );
+   }
+   sg_free_table( &global.sgTable );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Allocates the buffer in chunks of at most DMA_CHUNK_SIZE bytes
+ *        and describes them by global.sgTable.
+ */
+static int bufferAllocChunks( void )
+{
+   CHUNK_T* pChunks;
+   struct scatterlist* pSg;
+   size_t chunkSize = DMA_CHUNK_SIZE;
+   size_t remaining = global.size;
+   unsigned int n = 0;
+   unsigned int i;
+   int ret;
+
+   /*
+    * Worst case one page per chunk.
+    */
+   pChunks = kvmalloc_array( DIV_ROUND_UP( global.size, PAGE_SIZE ), sizeof( CHUNK_T ),
+                             GFP_KERNEL );
+   if( pChunks == NULL )
+      return -ENOMEM;
+
+   while( remaining > 0 )
+   {
+      size_t size = min( chunkSize, remaining );
+
+      pChunks[n].pPage = dma_alloc_pages( global.pDev, size, &pChunks[n].dmaAddr,
+                                          DMA_BIDIRECTIONAL, GFP_KERNEL | __GFP_NOWARN );
+      if( pChunks[n].pPage == NULL )
+      {
+         if( chunkSize == PAGE_SIZE )
+         {
+            ret = -ENOMEM;
+            goto L_FREE;
+         }
+         chunkSize /= 2;
+         continue;
+      }
+      pChunks[n].size = size;
+      remaining -= size;
+      n++;
+   }
+
+   ret = sg_alloc_table( &global.sgTable, n, GFP_KERNEL );
+   if( ret != 0 )
+      goto L_FREE;
+
+   for_each_sgtable_sg( &global.sgTable, pSg, i )
+   {
+      sg_set_page( pSg, pChunks[i].pPage, pChunks[i].size, 0 );
+      sg_dma_address( pSg ) = pChunks[i].dmaAddr;
+      sg_dma_len( pSg ) = pChunks[i].size;
+   }
+   kvfree( pChunks );
+   return 0;
+
+L_FREE:
+   for( i = 0; i < n; i++ )
+   {
+      dma_free_pages( global.pDev, pChunks[i].size, pChunks[i].pPage,
+                      pChunks[i].dmaAddr, DMA_BIDIRECTIONAL );
+   }
+   kvfree( pChunks );
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Allocates physically contiguous cacheable memory and maps it for
+ *        the device by dma_map_single().
+ */
+static int bufferAllocStreaming( void )
+{
+   global.pDmaVirt = alloc_pages_exact( global.size, GFP_KERNEL | __GFP_NOWARN );
+   if( global.pDmaVirt == NULL )
+      return -ENOMEM;
+
+   global.pDmaPhys = dma_map_single( global.pDev, global.pDmaVirt, global.size,
+                                     DMA_BIDIRECTIONAL );
+   if( dma_mapping_error( global.pDev, global.pDmaPhys ) )
+   {
+      free_pages_exact( global.pDmaVirt, global.size );
+      global.pDmaVirt = NULL;
+      return -ENOMEM;
+   }
+
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Allocates the DMA buffer of global.size bytes, first physically
+ *        contiguous, otherwise in chunks.
+ */
+static int bufferAlloc( void )
+{
+   if( streaming )
+   {
+      if( bufferAllocStreaming() == 0 )
+      {
+         global.layout = LAYOUT_STREAMING;
+         return 0;
+      }
+      /*
+       * The chunks are cacheable memory as well.
+       */
+      INFO_MESSAGE( "no contiguous memory for %zu bytes, allocating chunks\n", global.size );
+      global.layout = LAYOUT_CHUNKED;
+      return bufferAllocChunks();
+   }
+
+   global.pDmaVirt = dma_alloc_coherent( global.pDev, global.size, &global.pDmaPhys,
+                                         GFP_KERNEL | __GFP_NOWARN );
+   if( global.pDmaVirt != NULL )
+   {
+      global.layout = LAYOUT_CONTIGUOUS;
+      return 0;
+   }
+
+   INFO_MESSAGE( "no contiguous memory for %zu bytes, allocating chunks\n", global.size );
+   global.layout = LAYOUT_CHUNKED;
+   return bufferAllocChunks();
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void bufferFree( void )
+{
+   switch( global.layout )
+   {
+      case LAYOUT_CHUNKED:
+      {
+         bufferFreeChunks();
+         break;
+      }
+      case LAYOUT_STREAMING:
+      {
+         dma_unmap_single( global.pDev, global.pDmaPhys, global.size, DMA_BIDIRECTIONAL );
+         free_pages_exact( global.pDmaVirt, global.size );
+         break;
+      }
+      default:
+      {
+         dma_free_coherent( global.pDev, global.size, global.pDmaVirt, global.pDmaPhys );
+         break;
+      }
+   }
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Synchronizes the given range of cacheable memory for the CPU
+ *        respectively for the device. Coherent memory needs nothing.
+ * @param forCpu true: for the CPU; false: for the device.
+ */
+static void bufferSync( loff_t offset, size_t len, bool forCpu )
+{
+   struct scatterlist* pSg;
+   int i;
+
+   switch( global.layout )
+   {
+      case LAYOUT_STREAMING:
+      {
+         if( forCpu )
+            dma_sync_single_range_for_cpu( global.pDev, global.pDmaPhys, offset, len,
+                                           DMA_BIDIRECTIONAL );
+         else
+            dma_sync_single_range_for_device( global.pDev, global.pDmaPhys, offset, len,
+                                              DMA_BIDIRECTIONAL );
+         break;
+      }
+      case LAYOUT_CHUNKED:
+      {
+         for_each_sgtable_sg( &global.sgTable, pSg, i )
+         {
+            size_t n;
+
+            if( len == 0 )
+               break;
+            if( offset >= pSg->length )
+            {
+               offset -= pSg->length;
+               continue;
+            }
+            n = min_t( size_t, len, pSg->length - offset );
+            if( forCpu )
+               dma_sync_single_range_for_cpu( global.pDev, sg_dma_address( pSg ), offset, n,
+                                              DMA_BIDIRECTIONAL );
+            else
+               dma_sync_single_range_for_device( global.pDev, sg_dma_address( pSg ), offset, n,
+                                                 DMA_BIDIRECTIONAL );
+            len -= n;
+            offset = 0;
+         }
+         break;
+      }
+      default: break;
+   }
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Copies between the buffer and the user-space.
+ *
+ * In the layouts LAYOUT_CHUNKED and LAYOUT_STREAMING the pages are cacheable
+ * and become synchronized with the device for the copied range.
+ * @param toUser true: from buffer to user-space; false: vice versa.
+ * @return 0 or -EFAULT
+ */
+static int bufferCopy( loff_t offset, void __user* pUser, size_t len, bool toUser )
+{
+   struct scatterlist* pSg;
+   int i;
+
+   if( global.layout != LAYOUT_CHUNKED )
+   {
+      if( toUser )
+      {
+         bufferSync( offset, len, true );
+         return (copy_to_user( pUser, global.pDmaVirt + offset, len ) != 0)? -EFAULT : 0;
+      }
+      if( copy_from_user( global.pDmaVirt + offset, pUser, len ) != 0 )
+         return -EFAULT;
+      bufferSync( offset, len, false );
+      return 0;
+   }
+
+   for_each_sgtable_sg( &global.sgTable, pSg, i )
+   {
+      size_t n;
+      void* pVirt;
+
+      if( len == 0 )
+         break;
+      if( offset >= pSg->length )
+      {
+         offset -= pSg->length;
+         continue;
+      }
+      n = min_t( size_t, len, pSg->length - offset );
+      pVirt = page_address( sg_page( pSg ) ) + offset;
+      if( toUser )
+      {
+         dma_sync_single_range_for_cpu( global.pDev, sg_dma_address( pSg ), offset, n,
+                                        DMA_BIDIRECTIONAL );
+         if( copy_to_user( pUser, pVirt, n ) != 0 )
+            return -EFAULT;
+      }
+      else
+      {
+         if( copy_from_user( pVirt, pUser, n ) != 0 )
+            return -EFAULT;
+         dma_sync_single_range_for_device( global.pDev, sg_dma_address( pSg ), offset, n,
+                                           DMA_BIDIRECTIONAL );
+      }
+      pUser += n;
+      len -= n;
+      offset = 0;
+   }
+
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns true when the given range overlaps a locked range and at
+ *        least one of both is written.
+ * @note global.rangeLock has to be held.
+ */
+static bool rangeConflicts( RANGE_T* pRange )
+{
+   RANGE_T* pLocked;
+
+   list_for_each_entry( pLocked, &global.rangeList, entry )
+   {
+      if( (pRange->start < pLocked->end) && (pLocked->start < pRange->end) &&
+          (pRange->write || pLocked->write) )
+         return true;
+   }
+   return false;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Locks the byte range [start, start + len) of the buffer.
+ *
+ * Readers of the same range share it, a writer gets it exclusively.
+ * Accesses to disjoint ranges run in parallel, so several threads
+ * can fill different regions of the buffer at the same time.
+ * @retval 0 Range locked.
+ * @retval -ERESTARTSYS Interrupted by a signal.
+ */
+static int rangeLock( RANGE_T* pRange, loff_t start, size_t len, bool write )
+{
+   int ret;
+
+   pRange->start = start;
+   pRange->end   = start + len;
+   pRange->write = write;
+
+   spin_lock_irq( &global.rangeLock );
+   ret = wait_event_interruptible_lock_irq( global.rangeWaitQueue,
+                                            !rangeConflicts( pRange ),
+                                            global.rangeLock );
+   if( ret == 0 )
+      list_add( &pRange->entry, &global.rangeList );
+   spin_unlock_irq( &global.rangeLock );
+
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void rangeUnlock( RANGE_T* pRange )
+{
+   spin_lock_irq( &global.rangeLock );
+   list_del( &pRange->entry );
+   spin_unlock_irq( &global.rangeLock );
+   wake_up_all( &global.rangeWaitQueue );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Sets the file position, the size of the device is the size
+ *        of the buffer.
+ */
+static loff_t onLlseek( struct file* pFile, loff_t offset, int whence )
+{
+   return fixed_size_llseek( pFile, offset, whence, global.size );
+}
+
+/*!----------------------------------------------------------------------------
+ * @note Serves pread() as well, then pOffset points to its offset
+ *       instead of the file position.
  */
 static ssize_t onRead( struct file* pFile,
                        char __user* pUserBuffer,
@@ -65,22 +497,29 @@ static ssize_t onRead( struct file* pFile,
                        loff_t* pOffset )
 {
    DEBUG_MESSAGE( "minor: %d\n", ((struct miscdevice*)pFile->private_data)->minor );
-   if( *pOffset >= DMA_BUFFER_SIZE )
+   if( *pOffset >= global.size )
       return 0;
 
-   if( len > DMA_BUFFER_SIZE - *pOffset )
-      len = DMA_BUFFER_SIZE - *pOffset;
+   if( len > global.size - *pOffset )
+      len = global.size - *pOffset;
 
-   if( copy_to_user( pUserBuffer, global.pDmaVirt + *pOffset, len ) != 0 )
+   RANGE_T range;
+   if( rangeLock( &range, *pOffset, len, false ) != 0 )
+      return -ERESTARTSYS;
+   int ret = bufferCopy( *pOffset, pUserBuffer, len, true );
+   rangeUnlock( &range );
+   if( ret != 0 )
    {
       ERROR_MESSAGE( "copy_to_user\n" );
-      return -EFAULT;
+      return ret;
    }
    *pOffset += len;
    return len;
 }
 
 /*!----------------------------------------------------------------------------
+ * @note Serves pwrite() as well, then pOffset points to its offset
+ *       instead of the file position.
  */
 static ssize_t onWrite( struct file *pFile,
                         const char __user* pUserBuffer,
@@ -88,38 +527,229 @@ static ssize_t onWrite( struct file *pFile,
                         loff_t* pOffset )
 {
    DEBUG_MESSAGE( "minor: %d\n", ((struct miscdevice*)pFile->private_data)->minor );
-   if( *pOffset >= DMA_BUFFER_SIZE )
+   if( *pOffset >= global.size )
    {
-      ERROR_MESSAGE( "*pOffset >= DMA_BUFFER_SIZE\n" );
+      ERROR_MESSAGE( "*pOffset >= buffer size\n" );
       return -ENOMEM;
    }
 
-   if( len > DMA_BUFFER_SIZE - *pOffset )
-      len = DMA_BUFFER_SIZE - *pOffset;
+   if( len > global.size - *pOffset )
+      len = global.size - *pOffset;
 
-   if( copy_from_user( global.pDmaVirt + *pOffset, pUserBuffer, len ) != 0 )
+   RANGE_T range;
+   if( rangeLock( &range, *pOffset, len, true ) != 0 )
+      return -ERESTARTSYS;
+   int ret = bufferCopy( *pOffset, (void __user*)pUserBuffer, len, false );
+   rangeUnlock( &range );
+   if( ret != 0 )
    {
       ERROR_MESSAGE( "copy_from_user\n" );
-      return -EFAULT;
+      return ret;
    }
 
    *pOffset += len;
    return len;
 }
 
+/*!----------------------------------------------------------------------------
+ * @brief Zero-copy write from the user buffer described by pSg.
+ *
+ * The user pages become pinned and mapped by a scatter-gather list
+ * for the device with DMA_TO_DEVICE, so the device can read the data
+ * straight from the user memory.
+ */
+static long writeSg( DMATEST_SG_T* pSg )
+{
+   struct page** ppPages;
+   struct sg_table sgTable;
+   struct scatterlist* pSgEntry;
+   unsigned long offset;
+   unsigned int nPages;
+   int pinned;
+   int i;
+   long ret;
+
+   if( (pSg->length == 0) || (pSg->length > DMA_SG_MAX_LENGTH) )
+      return -EINVAL;
+
+   offset = pSg->address & ~PAGE_MASK;
+   nPages = DIV_ROUND_UP( offset + pSg->length, PAGE_SIZE );
+
+   ppPages = kvmalloc_array( nPages, sizeof( struct page* ), GFP_KERNEL );
+   if( ppPages == NULL )
+      return -ENOMEM;
+
+   /*
+    * The device only reads the pages, so they are pinned without FOLL_WRITE.
+    */
+   pinned = pin_user_pages_fast( pSg->address & PAGE_MASK, nPages, 0, ppPages );
+   if( pinned < 0 )
+   {
+      ERROR_MESSAGE( "pin_user_pages_fast: %d\n", pinned );
+      ret = pinned;
+      goto L_FREE;
+   }
+   if( pinned != nPages )
+   {
+      ERROR_MESSAGE( "pin_user_pages_fast: %d of %u pages\n", pinned, nPages );
+      ret = -EFAULT;
+      goto L_UNPIN;
+   }
+
+   ret = sg_alloc_table_from_pages( &sgTable, ppPages, nPages, offset,
+                                    pSg->length, GFP_KERNEL );
+   if( ret != 0 )
+   {
+      ERROR_MESSAGE( "sg_alloc_table_from_pages: %ld\n", ret );
+      goto L_UNPIN;
+   }
+
+   ret = dma_map_sgtable( global.pDev, &sgTable, DMA_TO_DEVICE, 0 );
+   if( ret != 0 )
+   {
+      ERROR_MESSAGE( "dma_map_sgtable: %ld\n", ret );
+      goto L_SG_FREE;
+   }
+
+   pSg->pages = nPages;
+   pSg->segments = sgTable.nents;
+   pSg->mapped = 0;
+   /*
+    * Here a real device would become programmed with the DMA segments.
+    */
+   for_each_sgtable_dma_sg( &sgTable, pSgEntry, i )
+      pSg->mapped += sg_dma_len( pSgEntry );
+
+   DEBUG_MESSAGE( "pages: %u, segments: %u, mapped: %llu bytes\n",
+                  pSg->pages, pSg->segments, pSg->mapped );
+
+   dma_unmap_sgtable( global.pDev, &sgTable, DMA_TO_DEVICE, 0 );
+   ret = 0;
+
+L_SG_FREE:
+   sg_free_table( &sgTable );
+L_UNPIN:
+   if( pinned > 0 )
+      unpin_user_pages( ppPages, pinned );
+L_FREE:
+   kvfree( ppPages );
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static long onIoctl( struct file* pFile, unsigned int cmd, unsigned long arg )
+{
+   DMATEST_SG_T sg;
+   long ret;
+
+   DEBUG_MESSAGE( "minor: %d\n", ((struct miscdevice*)pFile->private_data)->minor );
+   switch( cmd )
+   {
+      case DMATEST_IOCTL_WRITE_SG:
+      {
+         if( copy_from_user( &sg, (void __user*)arg, sizeof( sg ) ) != 0 )
+            return -EFAULT;
+         ret = writeSg( &sg );
+         if( ret != 0 )
+            return ret;
+         if( copy_to_user( (void __user*)arg, &sg, sizeof( sg ) ) != 0 )
+            return -EFAULT;
+         return 0;
+      }
+   }
+
+   return -ENOTTY;
+}
 
 static const struct file_operations mg_fops =
 {
-   .owner = THIS_MODULE,
-   .read  = onRead,
-   .write = onWrite
+   .owner          = THIS_MODULE,
+   .llseek         = onLlseek,
+   .read           = onRead,
+   .write          = onWrite,
+   .unlocked_ioctl = onIoctl
 };
 
+/****************** Device attribut functions ********************************/
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/misc/dmatest/layout
+ * Output: "contiguous", "chunked" or "streaming"
+ */
+static ssize_t layout_show( struct device* pDev,
+                            struct device_attribute* pAttr, char* pBuf )
+{
+   static const char* names[] =
+   {
+      [LAYOUT_CONTIGUOUS] = "contiguous",
+      [LAYOUT_CHUNKED]    = "chunked",
+      [LAYOUT_STREAMING]  = "streaming"
+   };
+
+   return sysfs_emit( pBuf, "%s\n", names[global.layout] );
+}
+
+static DEVICE_ATTR_RO( layout );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/misc/dmatest/size
+ */
+static ssize_t size_show( struct device* pDev,
+                          struct device_attribute* pAttr, char* pBuf )
+{
+   return sysfs_emit( pBuf, "%zu\n", global.size );
+}
+
+static DEVICE_ATTR_RO( size );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/misc/dmatest/chunks
+ * Output: one line "<dma-address> <length>" per physically contiguous chunk.
+ */
+static ssize_t chunks_show( struct device* pDev,
+                            struct device_attribute* pAttr, char* pBuf )
+{
+   struct scatterlist* pSg;
+   int len = 0;
+   int i;
+
+   if( global.layout != LAYOUT_CHUNKED )
+      return sysfs_emit( pBuf, "%pad %zu\n", &global.pDmaPhys, global.size );
+
+   for_each_sgtable_dma_sg( &global.sgTable, pSg, i )
+   {
+      /*
+       * Room for one further line, otherwise the list becomes truncated.
+       */
+      if( len > (PAGE_SIZE - 48) )
+         break;
+      len += sysfs_emit_at( pBuf, len, "%pad %u\n",
+                            &sg_dma_address( pSg ), sg_dma_len( pSg ) );
+   }
+   return len;
+}
+
+static DEVICE_ATTR_RO( chunks );
+
+static struct attribute* dma_attrs[] =
+{
+   &dev_attr_layout.attr,
+   &dev_attr_size.attr,
+   &dev_attr_chunks.attr,
+   NULL
+};
+
+ATTRIBUTE_GROUPS( dma );
+
+/****************** End device attribut functions ****************************/
+
 static struct miscdevice mg_miscdev =
 {
    .minor = MISC_DYNAMIC_MINOR,
    .name  = DEVICE_BASE_FILE_NAME,
-   .fops  = &mg_fops
+   .fops   = &mg_fops,
+   .groups = dma_groups
 };
 
 /*!----------------------------------------------------------------------------
@@ -130,6 +760,10 @@ static int __init driverInit( void )
    DEBUG_MESSAGE( "\n" );
    int ret;
 
+   INIT_LIST_HEAD( &global.rangeList );
+   spin_lock_init( &global.rangeLock );
+   init_waitqueue_head( &global.rangeWaitQueue );
+
    ret = misc_register( &mg_miscdev );
    if( ret != 0 )
    {
@@ -143,15 +777,27 @@ static int __init driverInit( void )
        global.pDev->dma_mask = &global.pDev->coherent_dma_mask;
    global.pDev->coherent_dma_mask = DMA_BIT_MASK(32);  // oder 64, je nach Plattform
 
-   global.pDmaVirt = dma_alloc_coherent( global.pDev, DMA_BUFFER_SIZE, &global.pDmaPhys, GFP_KERNEL );
-   if( global.pDmaVirt == NULL )
+   global.size = PAGE_ALIGN( bufferSize );
+   if( global.size == 0 )
    {
-      ERROR_MESSAGE( "dma_alloc_coherent\n" );
+      ERROR_MESSAGE( "bufferSize: 0\n" );
       misc_deregister( &mg_miscdev );
-      return -ENOMEM;
+      return -EINVAL;
+   }
+
+   ret = bufferAlloc();
+   if( ret != 0 )
+   {
+      ERROR_MESSAGE( "unable to allocate %zu bytes\n", global.size );
+      misc_deregister( &mg_miscdev );
+      return ret;
    }
 #endif
-   INFO_MESSAGE(" loaded, virt=0x%p, phys=%pad\n", global.pDmaVirt, &global.pDmaPhys );
+   if( global.layout == LAYOUT_CHUNKED )
+      INFO_MESSAGE(" loaded, %zu bytes in %u chunks\n", global.size, global.sgTable.nents );
+   else
+      INFO_MESSAGE(" loaded, %zu bytes, virt=0x%p, phys=%pad\n", global.size,
+                   global.pDmaVirt, &global.pDmaPhys );
    return 0;
 }
 
@@ -162,7 +808,7 @@ static void __exit driverExit( void )
 {
    DEBUG_MESSAGE( "\n" );
 
-   dma_free_coherent(global.pDev, DMA_BUFFER_SIZE, global.pDmaVirt, global.pDmaPhys);
+   bufferFree();
    misc_deregister( &mg_miscdev );
 }
 
@@ -0,0 +1,51 @@
+/*****************************************************************************/
+/*                                                                           */
+/*!  @brief Common header file for ioctl-commands of the                     */
+/*!         simple test driver for DMA accesses /dev/dmatest                 */
+/*                                                                           */
+/*---------------------------------------------------------------------------*/
+/*! @file    dma_test_ctl.h                                                  */
+/*! @author  Ulrich Becker                                                   */
+/*! @date    18.10.2026                                                      */
+/*****************************************************************************/
+#ifndef _DMA_TEST_CTL_H
+#define _DMA_TEST_CTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#ifndef __KERNEL__
+ #include <sys/ioctl.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+#define DMATEST_DEVICE_NAME "dmatest"
+
+/*!
+ * @brief Argument of DMATEST_IOCTL_WRITE_SG.
+ */
+typedef struct
+{
+   /*! @brief User-space address of the data to transfer. */
+   __u64 address;
+   /*! @brief Number of bytes to transfer. */
+   __u64 length;
+   /*! @brief Output: number of bytes mapped for the device. */
+   __u64 mapped;
+   /*! @brief Output: number of pinned user pages. */
+   __u32 pages;
+   /*! @brief Output: number of DMA segments after mapping, adjacent pages
+    *         can become merged, e.g. by a IOMMU. */
+   __u32 segments;
+} DMATEST_SG_T;
+
+#define DMATEST_IOCTL_MAGIC 'D'
+
+/*!
+ * @brief Zero-copy write: the user buffer becomes pinned and mapped by
+ *        a scatter-gather list for the device, the CPU copies nothing.
+ */
+#define DMATEST_IOCTL_WRITE_SG _IOWR( DMATEST_IOCTL_MAGIC, 1, DMATEST_SG_T )
+
+#endif /* ifndef _DMA_TEST_CTL_H */
+/*================================== EOF ====================================*/
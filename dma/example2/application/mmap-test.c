@@ -8,6 +8,26 @@
 /*! @author Ulrich Becker                                                    */
 /*! @date   10.04.2025                                                       */
 /*****************************************************************************/
+/*! @note Besides the short demonstration the program is a bandwidth
+ *        benchmark of the CPU on the mapped DMA buffer: memcpy(), SIMD
+ *        read and write kernels (SSE2/AVX2 on x86-64, NEON on ARM) and
+ *        non-temporal stores, each running multi-threaded over the mapped
+ *        buffer and over a buffer from malloc() as baseline.
+ *        Finally it measures the cost of a complete round trip
+ *        CPU -> device -> CPU including the cache maintenance.
+ *        For a comparison of coherent and cacheable (streaming) memory
+ *        and of the mapping attributes run it with each mode of the
+ *        driver:
+ *! @code
+ * insmod dmatest-user.ko bufferSize=16777216
+ * ./mmaptest -t 4
+ * ./mmaptest -t 4 -a wc
+ * ./mmaptest -t 4 -a uc
+ * rmmod dmatest-user
+ * insmod dmatest-user.ko bufferSize=16777216 streaming=1
+ * ./mmaptest -t 4
+ *! @endcode
+ */
 #include <stdio.h>
 #include <signal.h>
 #include <sys/stat.h>
@@ -19,16 +39,536 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <dma_test_user_ctl.h>
 
+#if defined( __x86_64__ )
+ #include <immintrin.h>
+#endif
+#if defined( __ARM_NEON )
+ #include <arm_neon.h>
+#endif
 
-#define DRIVER_NAME "/dev/dmatest_user"
-#define SIZE 4096
+#define DRIVER_NAME "/dev/" DMATEST_USER_DEVICE_NAME
+#define SYSFS_DIR   "/sys/class/misc/" DMATEST_USER_DEVICE_NAME "/"
+#define DEFAULT_SIZE 4096
+#define ITERATIONS   20
+#define MAX_THREADS  64
 
-int main( void )
+/*!
+ * @brief Bytes transferred per measurement, when the number of iterations
+ *        isn't given by option -i.
+ */
+#define BYTES_PER_MEASUREMENT (256 * 1024 * 1024)
+
+/*!
+ * @brief Granularity of the slices of the threads, a multiple of the
+ *        unrolled loops of the SIMD kernels.
+ */
+#define SLICE_ALIGNMENT 256
+
+/*!
+ * @brief Kernel working on a slice of a buffer.
+ * @param pBuffer Slice of the measured buffer, aligned to SLICE_ALIGNMENT.
+ * @param pScratch Private buffer of the thread with the same size, source
+ *                 respectively target of the memcpy() kernels.
+ * @param size Size of the slice, a multiple of SLICE_ALIGNMENT.
+ * @return Value depending on the read data, so the compiler can't omit
+ *         the reads.
+ */
+typedef uint64_t (*KERNEL_FUNC_T)( void* pBuffer, void* pScratch, size_t size );
+
+typedef struct
+{
+   const char*    pName;
+   KERNEL_FUNC_T  function;
+   /*! @brief Runtime check of the instruction set, NULL: always supported. */
+   bool           (*isSupported)( void );
+} KERNEL_T;
+
+/*!
+ * @brief Job of one thread.
+ */
+typedef struct
+{
+   pthread_t          thread;
+   const KERNEL_T*    pKernel;
+   uint8_t*           pBuffer;
+   uint8_t*           pScratch;
+   size_t             size;
+   unsigned int       iterations;
+   pthread_barrier_t* pBarrier;
+   uint64_t           result;
+} JOB_T;
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns CLOCK_MONOTONIC in seconds.
+ */
+static double getTime( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Reads a line of a sysfs attribute of the driver.
+ */
+static int readAttribute( const char* pName, char* pBuffer, size_t size )
+{
+   FILE* pFile = fopen( pName, "r" );
+   if( pFile == NULL )
+      return -1;
+   int ret = (fgets( pBuffer, size, pFile ) == NULL)? -1 : 0;
+   fclose( pFile );
+   pBuffer[strcspn( pBuffer, "\n" )] = '\0';
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Hands the whole buffer over to the CPU respectively to the device.
+ */
+static int syncBuffer( int fd, size_t size, unsigned long cmd )
+{
+   DMATEST_USER_RANGE_T range = { .offset = 0, .length = size };
+   return ioctl( fd, cmd, &range );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Reads the whole buffer, the sum prevents the compiler from
+ *        optimizing the reads away.
+ */
+static uint64_t readBuffer( const void* pMem, size_t size )
+{
+   const volatile uint64_t* p = pMem;
+   uint64_t sum = 0;
+   for( size_t i = 0; i < size / sizeof( uint64_t ); i++ )
+      sum += p[i];
+   return sum;
+}
+
+/****************** Kernels **************************************************/
+
+/*!----------------------------------------------------------------------------
+ */
+static uint64_t memcpyRead( void* pBuffer, void* pScratch, size_t size )
+{
+   memcpy( pScratch, pBuffer, size );
+   return ((volatile uint8_t*)pScratch)[size - 1];
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static uint64_t memcpyWrite( void* pBuffer, void* pScratch, size_t size )
+{
+   memcpy( pBuffer, pScratch, size );
+   return 0;
+}
+
+#if defined( __x86_64__ )
+/*!----------------------------------------------------------------------------
+ */
+static uint64_t sse2Read( void* pBuffer, void* pScratch, size_t size )
+{
+   const __m128i* p = pBuffer;
+   __m128i a0 = _mm_setzero_si128();
+   __m128i a1 = _mm_setzero_si128();
+   __m128i a2 = _mm_setzero_si128();
+   __m128i a3 = _mm_setzero_si128();
+
+   for( size_t i = 0; i < size / sizeof( __m128i ); i += 4 )
+   {
+      a0 = _mm_or_si128( a0, _mm_load_si128( p + i ) );
+      a1 = _mm_or_si128( a1, _mm_load_si128( p + i + 1 ) );
+      a2 = _mm_or_si128( a2, _mm_load_si128( p + i + 2 ) );
+      a3 = _mm_or_si128( a3, _mm_load_si128( p + i + 3 ) );
+   }
+   a0 = _mm_or_si128( _mm_or_si128( a0, a1 ), _mm_or_si128( a2, a3 ) );
+   return (uint64_t)_mm_cvtsi128_si64( a0 );
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static uint64_t sse2Write( void* pBuffer, void* pScratch, size_t size )
+{
+   __m128i* p = pBuffer;
+   const __m128i v = _mm_set1_epi32( 0x5A5A5A5A );
+
+   for( size_t i = 0; i < size / sizeof( __m128i ); i += 4 )
+   {
+      _mm_store_si128( p + i, v );
+      _mm_store_si128( p + i + 1, v );
+      _mm_store_si128( p + i + 2, v );
+      _mm_store_si128( p + i + 3, v );
+   }
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Non-temporal stores bypass the cache and need no read for
+ *        ownership of the cache lines.
+ */
+static uint64_t sse2Stream( void* pBuffer, void* pScratch, size_t size )
+{
+   __m128i* p = pBuffer;
+   const __m128i v = _mm_set1_epi32( 0x5A5A5A5A );
+
+   for( size_t i = 0; i < size / sizeof( __m128i ); i += 4 )
+   {
+      _mm_stream_si128( p + i, v );
+      _mm_stream_si128( p + i + 1, v );
+      _mm_stream_si128( p + i + 2, v );
+      _mm_stream_si128( p + i + 3, v );
+   }
+   _mm_sfence();
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static bool hasAvx2( void )
+{
+   return __builtin_cpu_supports( "avx2" ) != 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+__attribute__((target("avx2")))
+static uint64_t avx2Read( void* pBuffer, void* pScratch, size_t size )
+{
+   const __m256i* p = pBuffer;
+   __m256i a0 = _mm256_setzero_si256();
+   __m256i a1 = _mm256_setzero_si256();
+   __m256i a2 = _mm256_setzero_si256();
+   __m256i a3 = _mm256_setzero_si256();
+
+   for( size_t i = 0; i < size / sizeof( __m256i ); i += 4 )
+   {
+      a0 = _mm256_or_si256( a0, _mm256_load_si256( p + i ) );
+      a1 = _mm256_or_si256( a1, _mm256_load_si256( p + i + 1 ) );
+      a2 = _mm256_or_si256( a2, _mm256_load_si256( p + i + 2 ) );
+      a3 = _mm256_or_si256( a3, _mm256_load_si256( p + i + 3 ) );
+   }
+   a0 = _mm256_or_si256( _mm256_or_si256( a0, a1 ), _mm256_or_si256( a2, a3 ) );
+   return (uint64_t)_mm_cvtsi128_si64( _mm256_castsi256_si128( a0 ) );
+}
+
+/*!----------------------------------------------------------------------------
+ */
+__attribute__((target("avx2")))
+static uint64_t avx2Write( void* pBuffer, void* pScratch, size_t size )
+{
+   __m256i* p = pBuffer;
+   const __m256i v = _mm256_set1_epi32( 0x5A5A5A5A );
+
+   for( size_t i = 0; i < size / sizeof( __m256i ); i += 4 )
+   {
+      _mm256_store_si256( p + i, v );
+      _mm256_store_si256( p + i + 1, v );
+      _mm256_store_si256( p + i + 2, v );
+      _mm256_store_si256( p + i + 3, v );
+   }
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+__attribute__((target("avx2")))
+static uint64_t avx2Stream( void* pBuffer, void* pScratch, size_t size )
+{
+   __m256i* p = pBuffer;
+   const __m256i v = _mm256_set1_epi32( 0x5A5A5A5A );
+
+   for( size_t i = 0; i < size / sizeof( __m256i ); i += 4 )
+   {
+      _mm256_stream_si256( p + i, v );
+      _mm256_stream_si256( p + i + 1, v );
+      _mm256_stream_si256( p + i + 2, v );
+      _mm256_stream_si256( p + i + 3, v );
+   }
+   _mm_sfence();
+   return 0;
+}
+#endif /* if defined( __x86_64__ ) */
+
+#if defined( __ARM_NEON )
+/*!----------------------------------------------------------------------------
+ */
+static uint64_t neonRead( void* pBuffer, void* pScratch, size_t size )
+{
+   const uint64_t* p = pBuffer;
+   uint64x2_t a0 = vdupq_n_u64( 0 );
+   uint64x2_t a1 = vdupq_n_u64( 0 );
+   uint64x2_t a2 = vdupq_n_u64( 0 );
+   uint64x2_t a3 = vdupq_n_u64( 0 );
+
+   for( size_t i = 0; i < size / sizeof( uint64_t ); i += 8 )
+   {
+      a0 = vorrq_u64( a0, vld1q_u64( p + i ) );
+      a1 = vorrq_u64( a1, vld1q_u64( p + i + 2 ) );
+      a2 = vorrq_u64( a2, vld1q_u64( p + i + 4 ) );
+      a3 = vorrq_u64( a3, vld1q_u64( p + i + 6 ) );
+   }
+   a0 = vorrq_u64( vorrq_u64( a0, a1 ), vorrq_u64( a2, a3 ) );
+   return vgetq_lane_u64( a0, 0 ) | vgetq_lane_u64( a0, 1 );
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static uint64_t neonWrite( void* pBuffer, void* pScratch, size_t size )
 {
+   uint64_t* p = pBuffer;
+   const uint64x2_t v = vdupq_n_u64( 0x5A5A5A5A5A5A5A5AULL );
+
+   for( size_t i = 0; i < size / sizeof( uint64_t ); i += 8 )
+   {
+      vst1q_u64( p + i, v );
+      vst1q_u64( p + i + 2, v );
+      vst1q_u64( p + i + 4, v );
+      vst1q_u64( p + i + 6, v );
+   }
+   return 0;
+}
+
+ #if defined( __aarch64__ )
+/*!----------------------------------------------------------------------------
+ * @brief Non-temporal store pairs, there is no intrinsic for STNP.
+ */
+static uint64_t neonStream( void* pBuffer, void* pScratch, size_t size )
+{
+   uint8_t* p = pBuffer;
+   const uint64x2_t v = vdupq_n_u64( 0x5A5A5A5A5A5A5A5AULL );
+
+   for( size_t i = 0; i < size; i += 64 )
+   {
+      __asm__ volatile( "stnp %q1, %q1, [%0]\n\t"
+                        "stnp %q1, %q1, [%0, #32]"
+                        : : "r"( p + i ), "w"( v ) : "memory" );
+   }
+   __asm__ volatile( "dmb ishst" : : : "memory" );
+   return 0;
+}
+ #endif
+#endif /* if defined( __ARM_NEON ) */
+
+static const KERNEL_T mg_kernels[] =
+{
+   { "memcpy-read",   memcpyRead,  NULL },
+   { "memcpy-write",  memcpyWrite, NULL },
+#if defined( __x86_64__ )
+   { "sse2-read",     sse2Read,    NULL },
+   { "sse2-write",    sse2Write,   NULL },
+   { "sse2-nt-write", sse2Stream,  NULL },
+   { "avx2-read",     avx2Read,    hasAvx2 },
+   { "avx2-write",    avx2Write,   hasAvx2 },
+   { "avx2-nt-write", avx2Stream,  hasAvx2 },
+#endif
+#if defined( __ARM_NEON )
+   { "neon-read",     neonRead,    NULL },
+   { "neon-write",    neonWrite,   NULL },
+ #if defined( __aarch64__ )
+   { "neon-nt-write", neonStream,  NULL },
+ #endif
+#endif
+};
+
+/****************** End kernels **********************************************/
+
+/*!----------------------------------------------------------------------------
+ * @brief Thread function: runs the kernel on the slice of the thread.
+ */
+static void* threadFunction( void* pArg )
+{
+   JOB_T* pJob = pArg;
+
+   pthread_barrier_wait( pJob->pBarrier );
+   for( unsigned int i = 0; i < pJob->iterations; i++ )
+      pJob->result += pJob->pKernel->function( pJob->pBuffer, pJob->pScratch, pJob->size );
+   return NULL;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Runs the kernel by numThreads threads, each on its own slice of
+ *        the buffer.
+ * @param pScratch Scratch buffer of the same size as the buffer.
+ * @return Bandwidth in GB/s or a negative value on error.
+ */
+static double measure( const KERNEL_T* pKernel, uint8_t* pBuffer, uint8_t* pScratch,
+                       size_t size, unsigned int numThreads, unsigned int iterations,
+                       uint64_t* pResult )
+{
+   JOB_T jobs[MAX_THREADS];
+   pthread_barrier_t barrier;
+   const size_t slice = (size / numThreads) & ~(size_t)(SLICE_ALIGNMENT - 1);
+
+   if( slice == 0 )
+      return -1.0;
+
+   pthread_barrier_init( &barrier, NULL, numThreads + 1 );
+   for( unsigned int i = 0; i < numThreads; i++ )
+   {
+      jobs[i] = (JOB_T){ .pKernel = pKernel, .pBuffer = pBuffer + i * slice,
+                         .pScratch = pScratch + i * slice, .size = slice,
+                         .iterations = iterations, .pBarrier = &barrier };
+      if( pthread_create( &jobs[i].thread, NULL, threadFunction, &jobs[i] ) != 0 )
+      {
+         fprintf( stderr, "ERROR: pthread_create\n" );
+         exit( EXIT_FAILURE );
+      }
+   }
+
+   pthread_barrier_wait( &barrier );
+   const double start = getTime();
+   for( unsigned int i = 0; i < numThreads; i++ )
+   {
+      pthread_join( jobs[i].thread, NULL );
+      *pResult += jobs[i].result;
+   }
+   const double elapsed = getTime() - start;
+   pthread_barrier_destroy( &barrier );
+
+   return (double)slice * numThreads * iterations / elapsed / 1e9;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Runs all supported kernels with 1, 2, 4 ... maxThreads threads
+ *        over the buffer and prints the bandwidths.
+ */
+static void benchmark( const char* pRegionName, uint8_t* pBuffer, uint8_t* pScratch,
+                       size_t size, unsigned int maxThreads, unsigned int iterations,
+                       uint64_t* pResult )
+{
+   for( size_t k = 0; k < sizeof( mg_kernels ) / sizeof( mg_kernels[0] ); k++ )
+   {
+      const KERNEL_T* pKernel = &mg_kernels[k];
+
+      if( (pKernel->isSupported != NULL) && !pKernel->isSupported() )
+         continue;
+
+      for( unsigned int numThreads = 1; numThreads <= maxThreads; numThreads *= 2 )
+      {
+         const double bandwidth = measure( pKernel, pBuffer, pScratch, size,
+                                           numThreads, iterations, pResult );
+         if( bandwidth < 0.0 )
+            break;
+         printf( "%-8s %-14s %7u %10.2f\n", pRegionName, pKernel->pName,
+                 numThreads, bandwidth );
+         fflush( stdout );
+      }
+      /*
+       * Also the largest number of threads when it isn't a power of two.
+       */
+      if( (maxThreads & (maxThreads - 1)) != 0 )
+      {
+         const double bandwidth = measure( pKernel, pBuffer, pScratch, size,
+                                           maxThreads, iterations, pResult );
+         if( bandwidth >= 0.0 )
+            printf( "%-8s %-14s %7u %10.2f\n", pRegionName, pKernel->pName,
+                    maxThreads, bandwidth );
+      }
+   }
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Measures the cost of a round trip like a real application: the
+ *        CPU fills the buffer, the device takes it over and gives it back,
+ *        the CPU evaluates it.
+ */
+static int roundTrip( int fd, void* pMem, size_t size, uint64_t* pResult )
+{
+   const double start = getTime();
+   for( int i = 0; i < ITERATIONS; i++ )
+   {
+      if( syncBuffer( fd, size, DMATEST_USER_IOCTL_SYNC_FOR_CPU ) != 0 )
+         return -1;
+      memset( pMem, i, size );
+      if( syncBuffer( fd, size, DMATEST_USER_IOCTL_SYNC_FOR_DEVICE ) != 0 )
+         return -1;
+      if( syncBuffer( fd, size, DMATEST_USER_IOCTL_SYNC_FOR_CPU ) != 0 )
+         return -1;
+      *pResult += readBuffer( pMem, size );
+   }
+   const double roundTripTime = getTime() - start;
+
+   printf( "Round trip: %10.1f us per buffer (write, sync, sync, read)\n",
+           roundTripTime * 1e6 / ITERATIONS );
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void printHelp( const char* pProgramName )
+{
+   printf( "Usage: %s [options]\n"
+           "Options:\n"
+           "  -t <count>  Largest number of threads, default: 1, maximum: %d.\n"
+           "  -i <count>  Iterations per measurement, default: %d MiB / buffer size.\n"
+           "  -a <attr>   Memory attribute of the mapping:\n"
+           "              default, cached, wc (write-combined) or uc (uncached).\n"
+           "  -h          This help.\n",
+           pProgramName, MAX_THREADS, BYTES_PER_MEASUREMENT / (1024 * 1024) );
+}
+
+int main( int argc, char** argv )
+{
+   char text[64];
+   size_t size = DEFAULT_SIZE;
+   unsigned int maxThreads = 1;
+   unsigned int iterations = 0;
+   unsigned int mapAttr = DMATEST_USER_MAP_DEFAULT;
+   int opt;
+
+   while( (opt = getopt( argc, argv, "t:i:a:h" )) != -1 )
+   {
+      switch( opt )
+      {
+         case 't': maxThreads = (unsigned int)atoi( optarg ); break;
+         case 'i': iterations = (unsigned int)atoi( optarg ); break;
+         case 'a':
+         {
+            static const char* names[] =
+            {
+               [DMATEST_USER_MAP_DEFAULT]      = "default",
+               [DMATEST_USER_MAP_CACHED]       = "cached",
+               [DMATEST_USER_MAP_WRITECOMBINE] = "wc",
+               [DMATEST_USER_MAP_UNCACHED]     = "uc"
+            };
+            for( mapAttr = 0; mapAttr < sizeof( names ) / sizeof( names[0] ); mapAttr++ )
+            {
+               if( strcmp( optarg, names[mapAttr] ) == 0 )
+                  break;
+            }
+            if( mapAttr < sizeof( names ) / sizeof( names[0] ) )
+               break;
+            printHelp( argv[0] );
+            return EXIT_FAILURE;
+         }
+         case 'h': printHelp( argv[0] ); return EXIT_SUCCESS;
+         default:  printHelp( argv[0] ); return EXIT_FAILURE;
+      }
+   }
+   if( (maxThreads == 0) || (maxThreads > MAX_THREADS) )
+   {
+      printHelp( argv[0] );
+      return EXIT_FAILURE;
+   }
+
    printf( "Applicatuon part for testing the demo driver \"dmatest-user\"\n" );
 
+   if( readAttribute( SYSFS_DIR "size", text, sizeof( text ) ) == 0 )
+      size = strtoul( text, NULL, 10 );
+   if( readAttribute( SYSFS_DIR "layout", text, sizeof( text ) ) != 0 )
+      strcpy( text, "unknown" );
+   printf( "Buffer: %zu bytes, layout: %s\n", size, text );
+
+   if( iterations == 0 )
+      iterations = (size < BYTES_PER_MEASUREMENT)? BYTES_PER_MEASUREMENT / size : 1;
+
    int fd = open( DRIVER_NAME, O_RDWR );
    if( fd < 0 )
    {
@@ -36,19 +576,59 @@ int main( void )
       return EXIT_FAILURE;
    }
 
-   void* pMem = mmap( NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+   if( ioctl( fd, DMATEST_USER_IOCTL_SET_MAP_ATTR, &mapAttr ) != 0 )
+   {
+      fprintf( stderr, "ioctl: %s\n", strerror( errno ) );
+      close( fd );
+      return EXIT_FAILURE;
+   }
+
+   void* pMem = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
    if( pMem == MAP_FAILED )
    {
-      fprintf( stderr, "Can't make memory-map\n" );
+      fprintf( stderr, "Can't make memory-map: %s\n", strerror( errno ) );
       close( fd );
+      return EXIT_FAILURE;
    }
 
    strcpy( pMem, "Hello DMA!");
    printf("DMA-Buffer-Content: %s\n", (char*)pMem );
 
-   munmap( pMem, SIZE );
+   /*
+    * The baseline from malloc() and the scratch buffer of the memcpy()
+    * kernels, touched in advance so no page fault becomes measured.
+    */
+   uint8_t* pBaseline = aligned_alloc( SLICE_ALIGNMENT, size );
+   uint8_t* pScratch = aligned_alloc( SLICE_ALIGNMENT, size );
+   if( (pBaseline == NULL) || (pScratch == NULL) )
+   {
+      fprintf( stderr, "Can't allocate %zu bytes\n", size );
+      munmap( pMem, size );
+      close( fd );
+      return EXIT_FAILURE;
+   }
+   memset( pBaseline, 0xA5, size );
+   memset( pScratch, 0xA5, size );
+   memset( pMem, 0xA5, size );
+
+   uint64_t result = 0;
+   printf( "%-8s %-14s %7s %10s\n", "region", "kernel", "threads", "GB/s" );
+   benchmark( "mmap", pMem, pScratch, size, maxThreads, iterations, &result );
+   benchmark( "malloc", pBaseline, pScratch, size, maxThreads, iterations, &result );
+
+   int ret = EXIT_SUCCESS;
+   if( roundTrip( fd, pMem, size, &result ) != 0 )
+   {
+      fprintf( stderr, "ioctl: %s\n", strerror( errno ) );
+      ret = EXIT_FAILURE;
+   }
+   printf( "Checksum:   0x%016llX\n", (unsigned long long)result );
+
+   free( pScratch );
+   free( pBaseline );
+   munmap( pMem, size );
    close( fd );
-   return EXIT_SUCCESS;
+   return ret;
 }
 
 /*================================== EOF ====================================*/
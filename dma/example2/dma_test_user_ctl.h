@@ -0,0 +1,186 @@
+/*****************************************************************************/
+/*                                                                           */
+/*!  @brief Common header file for ioctl-commands of the test driver for    */
+/*!         DMA accesses and mapping to user-space /dev/dmatest_user         */
+/*                                                                           */
+/*---------------------------------------------------------------------------*/
+/*! @file    dma_test_user_ctl.h                                             */
+/*! @author  Ulrich Becker                                                   */
+/*! @date    18.10.2026                                                      */
+/*****************************************************************************/
+#ifndef _DMA_TEST_USER_CTL_H
+#define _DMA_TEST_USER_CTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#ifndef __KERNEL__
+ #include <sys/ioctl.h>
+ #include <sys/mman.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+#define DMATEST_USER_DEVICE_NAME "dmatest_user"
+
+/*!
+ * @brief Byte range of the buffer, argument of the sync ioctls.
+ */
+typedef struct
+{
+   __u64 offset;
+   __u64 length;
+} DMATEST_USER_RANGE_T;
+
+/*!
+ * @brief Layout of the memory, @see DMATEST_USER_GEOMETRY_T::layout
+ */
+#define DMATEST_USER_LAYOUT_CONTIGUOUS 0 /*!< @brief One coherent block. */
+#define DMATEST_USER_LAYOUT_CHUNKED    1 /*!< @brief Cacheable chunks. */
+#define DMATEST_USER_LAYOUT_STREAMING  2 /*!< @brief One cacheable block. */
+
+/*!
+ * @brief Geometry of the buffers, returned by DMATEST_USER_IOCTL_GET_GEOMETRY.
+ *
+ * The driver allocates count buffers of bufferSize bytes back to back.
+ * Buffer n becomes mapped by mmap() with the offset n * bufferSize, e.g.:
+ * @code
+ * pFrame[n] = mmap( NULL, geometry.bufferSize, PROT_READ | PROT_WRITE,
+ *                   MAP_SHARED, fd, n * geometry.bufferSize );
+ * @endcode
+ * A mapping may cover several consecutive buffers but not exceed the
+ * last one.
+ */
+typedef struct
+{
+   /*! @brief Size of each buffer in bytes, a multiple of the page size. */
+   __u64 bufferSize;
+   /*! @brief Size of all buffers in bytes. */
+   __u64 totalSize;
+   /*! @brief Number of buffers. */
+   __u32 count;
+   /*! @brief DMATEST_USER_LAYOUT_CONTIGUOUS, _CHUNKED or _STREAMING */
+   __u32 layout;
+} DMATEST_USER_GEOMETRY_T;
+
+#define DMATEST_USER_IOCTL_MAGIC 'U'
+
+/*!
+ * @brief Hands the range over to the CPU, e.g. before the process reads
+ *        data written by the device.
+ *
+ * Necessary when the driver has been loaded with streaming=1, because
+ * the mapped memory is cacheable. For coherent memory it does nothing.
+ */
+#define DMATEST_USER_IOCTL_SYNC_FOR_CPU    _IOW( DMATEST_USER_IOCTL_MAGIC, 1, DMATEST_USER_RANGE_T )
+
+/*!
+ * @brief Hands the range over to the device, e.g. after the process has
+ *        written data for the device.
+ *
+ * For coherent memory it drains the write buffers of the CPU, which is
+ * necessary after writing through a DMATEST_USER_MAP_WRITECOMBINE mapping.
+ */
+#define DMATEST_USER_IOCTL_SYNC_FOR_DEVICE _IOW( DMATEST_USER_IOCTL_MAGIC, 2, DMATEST_USER_RANGE_T )
+
+/*!
+ * @brief Gets the geometry of the buffers.
+ */
+#define DMATEST_USER_IOCTL_GET_GEOMETRY    _IOR( DMATEST_USER_IOCTL_MAGIC, 3, DMATEST_USER_GEOMETRY_T )
+
+/*!
+ * @brief Argument of DMATEST_USER_IOCTL_POOL_ALLOC.
+ */
+typedef struct
+{
+   /*! @brief Input: size in bytes; output: size rounded up to whole pages. */
+   __u64 size;
+   /*! @brief Output: offset for mmap() of this buffer. */
+   __u64 mmapOffset;
+   /*! @brief Output: DMA address of the buffer for the device. */
+   __u64 dmaAddress;
+   /*! @brief Output: handle for DMATEST_USER_IOCTL_POOL_FREE. */
+   __u32 handle;
+   __u32 reserved;
+} DMATEST_USER_POOL_ALLOC_T;
+
+/*!
+ * @brief Allocates a buffer from the coherent pool, the driver has to be
+ *        loaded with poolSize > 0.
+ *
+ * The buffer belongs to the opened file and becomes freed by close()
+ * at the latest. It becomes mapped by mmap() with the returned
+ * mmapOffset and a length up to the returned size.
+ */
+#define DMATEST_USER_IOCTL_POOL_ALLOC      _IOWR( DMATEST_USER_IOCTL_MAGIC, 4, DMATEST_USER_POOL_ALLOC_T )
+
+/*!
+ * @brief Frees a buffer of the pool, argument is a pointer to its __u32
+ *        handle. Fails with EBUSY as long as the buffer is mapped.
+ */
+#define DMATEST_USER_IOCTL_POOL_FREE       _IOW( DMATEST_USER_IOCTL_MAGIC, 5, __u32 )
+
+/*!
+ * @brief Memory attributes of the following mmap() calls of the opened
+ *        file, @see DMATEST_USER_IOCTL_SET_MAP_ATTR
+ */
+#define DMATEST_USER_MAP_DEFAULT      0 /*!< @brief As chosen by the DMA API. */
+/*!
+ * @brief Cached, best for data which becomes read repeatedly.
+ * Coherent memory is cached only on cache coherent platforms, otherwise
+ * mmap() fails with EINVAL. Cacheable memory (layouts
+ * DMATEST_USER_LAYOUT_STREAMING and _CHUNKED) needs the sync ioctls.
+ */
+#define DMATEST_USER_MAP_CACHED       1
+/*!
+ * @brief Write-combined, best for sequential writing only.
+ * Coherent memory only. Followed by DMATEST_USER_IOCTL_SYNC_FOR_DEVICE
+ * before the device reads the data.
+ */
+#define DMATEST_USER_MAP_WRITECOMBINE 2
+/*!
+ * @brief Uncached, each access goes to the memory. Coherent memory only.
+ * On ARM it is Normal non-cacheable memory like
+ * DMATEST_USER_MAP_WRITECOMBINE, because device memory faults on the
+ * unaligned accesses of memcpy().
+ */
+#define DMATEST_USER_MAP_UNCACHED     3
+
+/*!
+ * @brief Selects the memory attribute of the following mmap() calls of
+ *        the opened file, argument is a pointer to a unsigned int
+ *        containing a DMATEST_USER_MAP_* value.
+ *
+ * So one process can map the same buffer write-combined for producing
+ * and another one cached for consuming.
+ * On x86 DMATEST_USER_MAP_WRITECOMBINE and DMATEST_USER_MAP_UNCACHED fail
+ * with EOPNOTSUPP: PAT keeps user mappings of RAM write-back.
+ */
+#define DMATEST_USER_IOCTL_SET_MAP_ATTR    _IOW( DMATEST_USER_IOCTL_MAGIC, 7, unsigned int )
+
+/*!
+ * @brief Argument of DMATEST_USER_IOCTL_EXPORT.
+ */
+typedef struct
+{
+   /*! @brief Input: number of the buffer, 0 ... count - 1 */
+   __u32 index;
+   /*! @brief Input: 0 or O_CLOEXEC for the new file descriptor. */
+   __u32 flags;
+   /*! @brief Output: file descriptor of the dma-buf. */
+   __s32 fd;
+   __u32 reserved;
+} DMATEST_USER_EXPORT_T;
+
+/*!
+ * @brief Exports one buffer as dma-buf file descriptor.
+ *
+ * The dma-buf can be passed to other processes, e.g. via a unix socket,
+ * and to other drivers. It can be mapped by mmap() with offset 0, reads
+ * and writes of the CPU have to be enclosed by DMA_BUF_IOCTL_SYNC.
+ * The buffer stays valid as long as the dma-buf exists.
+ * Not supported in the layout DMATEST_USER_LAYOUT_CHUNKED.
+ */
+#define DMATEST_USER_IOCTL_EXPORT          _IOWR( DMATEST_USER_IOCTL_MAGIC, 6, DMATEST_USER_EXPORT_T )
+
+#endif /* ifndef _DMA_TEST_USER_CTL_H */
+/*================================== EOF ====================================*/
@@ -15,8 +15,100 @@
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/dma-mapping.h>
+#include <linux/dma-map-ops.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/scatterlist.h>
+#include <linux/overflow.h>
+#include <linux/huge_mm.h>
+#include <linux/pgtable.h>
+#include <linux/genalloc.h>
+#include <linux/idr.h>
+#include <linux/dma-buf.h>
+#include <linux/file.h>
+
+#include <dma_test_user_ctl.h>
 
 MODULE_LICENSE( "GPL" );
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+MODULE_IMPORT_NS( "DMA_BUF" );
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+MODULE_IMPORT_NS( DMA_BUF );
+#endif
+
+/*!
+ * @brief Size of the DMA buffer in bytes, becomes rounded up to whole pages.
+ *
+ * The buffer becomes allocated physically contiguous, large buffers come
+ * from the CMA area (kernel parameter cma=...). If no contiguous memory is
+ * available, the buffer becomes allocated in chunks described by a
+ * scatter-gather list.
+ * @see /sys/class/misc/dmatest_user/layout
+ */
+static unsigned long bufferSize = 4096;
+module_param( bufferSize, ulong, 0444 );
+MODULE_PARM_DESC( bufferSize, "Size of the DMA buffer in bytes" );
+
+/*!
+ * @brief Number of DMA buffers of bufferSize bytes each, e.g. 2 for double
+ *        or 4 for quad buffering.
+ *
+ * The buffers lie back to back in one allocation, so read() and write()
+ * see them as one file. The process maps buffer n by the mmap() offset
+ * n * bufferSize, @see DMATEST_USER_IOCTL_GET_GEOMETRY
+ */
+static unsigned int bufferCount = 1;
+module_param( bufferCount, uint, 0444 );
+MODULE_PARM_DESC( bufferCount, "Number of DMA buffers" );
+
+#define MAX_BUFFER_COUNT 64
+
+/*!
+ * @brief Allocates the buffers in chunks of 2 MiB (PMD_SIZE) and maps them
+ *        by huge-page PMD mappings, so a scan over large buffers needs one
+ *        TLB entry per 2 MiB instead of 512.
+ *
+ * bufferSize becomes rounded up to PMD_SIZE. The process gets huge
+ * mappings for each 2 MiB of the mapping which is backed by a naturally
+ * aligned chunk, the rest becomes mapped by 4 KiB pages.
+ * The chunks are cacheable memory, so the sync ioctls are necessary as in
+ * the streaming mode.
+ * @note PMD mappings of PFN ranges need Linux 6.12 and
+ *       CONFIG_ARCH_SUPPORTS_PMD_PFNMAP, otherwise the chunks become
+ *       mapped by 4 KiB pages only.
+ */
+static bool hugePages = false;
+module_param( hugePages, bool, 0444 );
+MODULE_PARM_DESC( hugePages, "Buffers of 2 MiB chunks mapped by huge pages" );
+
+/*!
+ * @brief Size in bytes of a coherent arena for short-lived buffers of
+ *        arbitrary size, 0: no pool.
+ *
+ * Buffers of the pool become allocated and freed by the ioctls
+ * DMATEST_USER_IOCTL_POOL_ALLOC and DMATEST_USER_IOCTL_POOL_FREE within
+ * microseconds instead of a dma_alloc_coherent() call.
+ * @see /sys/class/misc/dmatest_user/pool
+ */
+static unsigned long poolSize = 0;
+module_param( poolSize, ulong, 0444 );
+MODULE_PARM_DESC( poolSize, "Size of the coherent arena for pool buffers in bytes, 0: no pool" );
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)) && defined( CONFIG_ARCH_SUPPORTS_PMD_PFNMAP )
+ #define CONFIG_DMATEST_HUGE_PFNMAP
+#endif
+
+/*!
+ * @brief Allocates normal cacheable memory and maps it by dma_map_single()
+ *        instead of dma_alloc_coherent().
+ *
+ * On platforms without cache coherent DMA, coherent memory is uncached and
+ * slow for the CPU. Cacheable memory needs explicit synchronization by
+ * DMATEST_USER_IOCTL_SYNC_FOR_CPU and DMATEST_USER_IOCTL_SYNC_FOR_DEVICE.
+ */
+static bool streaming = false;
+module_param( streaming, bool, 0444 );
+MODULE_PARM_DESC( streaming, "Cacheable memory mapped by dma_map_single() instead of coherent memory" );
 
 #define CONFIG_DEBUG_SKELETON
 #define DEVICE_BASE_FILE_NAME KBUILD_MODNAME
@@ -45,18 +137,930 @@ MODULE_LICENSE( "GPL" );
 /* End of message helper macros for "dmesg" ++++++++***************************/
 
 
-#define DMA_BUFFER_SIZE 4096
+/*!
+ * @brief Largest chunk in layout LAYOUT_CHUNKED, chunks which can't be
+ *        allocated become halved down to one page.
+ */
+#define DMA_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef enum
+{
+   /*! @brief One coherent buffer, from the CMA area when it is large. */
+   LAYOUT_CONTIGUOUS = DMATEST_USER_LAYOUT_CONTIGUOUS,
+   /*! @brief Chunks of cacheable pages from dma_alloc_pages(). */
+   LAYOUT_CHUNKED    = DMATEST_USER_LAYOUT_CHUNKED,
+   /*! @brief One buffer of cacheable pages mapped by dma_map_single(). */
+   LAYOUT_STREAMING  = DMATEST_USER_LAYOUT_STREAMING
+} LAYOUT_T;
+
+/*!
+ * @brief Chunk during the allocation in layout LAYOUT_CHUNKED.
+ */
+typedef struct
+{
+   struct page* pPage;
+   dma_addr_t   dmaAddr;
+   size_t       size;
+} CHUNK_T;
 
 
 struct GLOBAL_T
 {
-   void*          pDmaVirt;
-   dma_addr_t     pDmaPhys;
-   struct device* pDev;
+   void*           pDmaVirt;
+   dma_addr_t      pDmaPhys;
+   struct device*  pDev;
+   /*! @brief Size of all buffers. */
+   size_t          size;
+   /*! @brief Size of one buffer. */
+   size_t          bufferSize;
+   unsigned int    count;
+   LAYOUT_T        layout;
+   /*!
+    * @brief Chunks of the buffer in layout LAYOUT_CHUNKED, each entry
+    *        contains the page and the DMA address of a chunk.
+    */
+   struct sg_table sgTable;
+
+   /*!
+    * @brief Allocator of the pool buffers in the coherent arena.
+    */
+   struct gen_pool* pPool;
+   void*           pArenaVirt;
+   dma_addr_t      arenaPhys;
+   size_t          arenaSize;
 };
 
+/*!
+ * @brief Opened file.
+ */
+typedef struct
+{
+   /*!
+    * @brief Serializes allocating, freeing and mapping of pool buffers.
+    */
+   struct mutex poolMutex;
+   /*!
+    * @brief Pool buffers of this file, indexed by their handle.
+    */
+   struct idr   poolBuffers;
+   /*!
+    * @brief Memory attribute of the following mmap() calls.
+    * @see DMATEST_USER_IOCTL_SET_MAP_ATTR
+    */
+   unsigned int mapAttr;
+} SESSION_T;
+
+/*!
+ * @brief Buffer of the pool.
+ * @see DMATEST_USER_IOCTL_POOL_ALLOC
+ */
+typedef struct
+{
+   void*      pVirt;
+   dma_addr_t dmaAddr;
+   size_t     size;
+   /*!
+    * @brief Number of user mappings, the buffer can't be freed as long
+    *        as it is mapped.
+    */
+   atomic_t   mapCount;
+} POOL_BUFFER_T;
+
 static struct GLOBAL_T global;
 
+/*!----------------------------------------------------------------------------
+ * @brief Frees the chunks of the buffer in layout LAYOUT_CHUNKED.
+ */
+static void bufferFreeChunks( void )
+{
+   struct scatterlist* pSg;
+   int i;
+
+   for_each_sgtable_sg( &global.sgTable, pSg, i )
+   {
+      dma_free_pages( global.pDev, pSg->length, sg_page( pSg ),
+                      sg_dma_address( pSg ), DMA_BIDIRECTIONAL );
+   }
+   sg_free_table( &global.sgTable );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Allocates the buffer in chunks of at most chunkSize bytes
+ *        and describes them by global.sgTable.
+ */
+static int bufferAllocChunks( size_t chunkSize )
+{
+   CHUNK_T* pChunks;
+   struct scatterlist* pSg;
+   size_t remaining = global.size;
+   unsigned int n = 0;
+   unsigned int i;
+   int ret;
+
+   /*
+    * Worst case one page per chunk.
+    */
+   pChunks = kvmalloc_array( DIV_ROUND_UP( global.size, PAGE_SIZE ), sizeof( CHUNK_T ),
+                             GFP_KERNEL );
+   if( pChunks == NULL )
+      return -ENOMEM;
+
+   while( remaining > 0 )
+   {
+      size_t size = min( chunkSize, remaining );
+
+      pChunks[n].pPage = dma_alloc_pages( global.pDev, size, &pChunks[n].dmaAddr,
+                                          DMA_BIDIRECTIONAL, GFP_KERNEL | __GFP_NOWARN );
+      if( pChunks[n].pPage == NULL )
+      {
+         if( chunkSize == PAGE_SIZE )
+         {
+            ret = -ENOMEM;
+            goto L_FREE;
+         }
+         chunkSize /= 2;
+         continue;
+      }
+      pChunks[n].size = size;
+      remaining -= size;
+      n++;
+   }
+
+   ret = sg_alloc_table( &global.sgTable, n, GFP_KERNEL );
+   if( ret != 0 )
+      goto L_FREE;
+
+   for_each_sgtable_sg( &global.sgTable, pSg, i )
+   {
+      sg_set_page( pSg, pChunks[i].pPage, pChunks[i].size, 0 );
+      sg_dma_address( pSg ) = pChunks[i].dmaAddr;
+      sg_dma_len( pSg ) = pChunks[i].size;
+   }
+   kvfree( pChunks );
+   return 0;
+
+L_FREE:
+   for( i = 0; i < n; i++ )
+   {
+      dma_free_pages( global.pDev, pChunks[i].size, pChunks[i].pPage,
+                      pChunks[i].dmaAddr, DMA_BIDIRECTIONAL );
+   }
+   kvfree( pChunks );
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Allocates physically contiguous cacheable memory and maps it for
+ *        the device by dma_map_single().
+ */
+static int bufferAllocStreaming( void )
+{
+   global.pDmaVirt = alloc_pages_exact( global.size, GFP_KERNEL | __GFP_NOWARN );
+   if( global.pDmaVirt == NULL )
+      return -ENOMEM;
+
+   global.pDmaPhys = dma_map_single( global.pDev, global.pDmaVirt, global.size,
+                                     DMA_BIDIRECTIONAL );
+   if( dma_mapping_error( global.pDev, global.pDmaPhys ) )
+   {
+      free_pages_exact( global.pDmaVirt, global.size );
+      global.pDmaVirt = NULL;
+      return -ENOMEM;
+   }
+
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Allocates the DMA buffer of global.size bytes, first physically
+ *        contiguous, otherwise in chunks.
+ */
+static int bufferAlloc( void )
+{
+   if( hugePages )
+   {
+      global.layout = LAYOUT_CHUNKED;
+      return bufferAllocChunks( PMD_SIZE );
+   }
+
+   if( streaming )
+   {
+      if( bufferAllocStreaming() == 0 )
+      {
+         global.layout = LAYOUT_STREAMING;
+         return 0;
+      }
+      /*
+       * The chunks are cacheable memory as well.
+       */
+      INFO_MESSAGE( "no contiguous memory for %zu bytes, allocating chunks\n", global.size );
+      global.layout = LAYOUT_CHUNKED;
+      return bufferAllocChunks( DMA_CHUNK_SIZE );
+   }
+
+   global.pDmaVirt = dma_alloc_coherent( global.pDev, global.size, &global.pDmaPhys,
+                                         GFP_KERNEL | __GFP_NOWARN );
+   if( global.pDmaVirt != NULL )
+   {
+      global.layout = LAYOUT_CONTIGUOUS;
+      return 0;
+   }
+
+   INFO_MESSAGE( "no contiguous memory for %zu bytes, allocating chunks\n", global.size );
+   global.layout = LAYOUT_CHUNKED;
+   return bufferAllocChunks( DMA_CHUNK_SIZE );
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void bufferFree( void )
+{
+   switch( global.layout )
+   {
+      case LAYOUT_CHUNKED:
+      {
+         bufferFreeChunks();
+         break;
+      }
+      case LAYOUT_STREAMING:
+      {
+         dma_unmap_single( global.pDev, global.pDmaPhys, global.size, DMA_BIDIRECTIONAL );
+         free_pages_exact( global.pDmaVirt, global.size );
+         break;
+      }
+      default:
+      {
+         dma_free_coherent( global.pDev, global.size, global.pDmaVirt, global.pDmaPhys );
+         break;
+      }
+   }
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Synchronizes the given range of cacheable memory for the CPU
+ *        respectively for the device. Coherent memory needs nothing.
+ * @param forCpu true: for the CPU; false: for the device.
+ */
+static void bufferSync( loff_t offset, size_t len, bool forCpu )
+{
+   struct scatterlist* pSg;
+   int i;
+
+   switch( global.layout )
+   {
+      case LAYOUT_STREAMING:
+      {
+         if( forCpu )
+            dma_sync_single_range_for_cpu( global.pDev, global.pDmaPhys, offset, len,
+                                           DMA_BIDIRECTIONAL );
+         else
+            dma_sync_single_range_for_device( global.pDev, global.pDmaPhys, offset, len,
+                                              DMA_BIDIRECTIONAL );
+         break;
+      }
+      case LAYOUT_CHUNKED:
+      {
+         for_each_sgtable_sg( &global.sgTable, pSg, i )
+         {
+            size_t n;
+
+            if( len == 0 )
+               break;
+            if( offset >= pSg->length )
+            {
+               offset -= pSg->length;
+               continue;
+            }
+            n = min_t( size_t, len, pSg->length - offset );
+            if( forCpu )
+               dma_sync_single_range_for_cpu( global.pDev, sg_dma_address( pSg ), offset, n,
+                                              DMA_BIDIRECTIONAL );
+            else
+               dma_sync_single_range_for_device( global.pDev, sg_dma_address( pSg ), offset, n,
+                                                 DMA_BIDIRECTIONAL );
+            len -= n;
+            offset = 0;
+         }
+         break;
+      }
+      default:
+      {
+         /*
+          * Coherent memory: drains the write-combining buffers of the CPU.
+          */
+         if( !forCpu )
+            wmb();
+         break;
+      }
+   }
+}
+
+/*!
+ * @brief Protection of DMATEST_USER_MAP_UNCACHED.
+ *
+ * On ARM pgprot_noncached() is device memory (Device-nGnRnE respectively
+ * strongly ordered), which faults on the unaligned accesses of memcpy().
+ * pgprot_writecombine() is Normal non-cacheable memory there.
+ */
+#if defined( CONFIG_ARM64 ) || defined( CONFIG_ARM )
+ #define pgprot_uncached( prot ) pgprot_writecombine( prot )
+#else
+ #define pgprot_uncached( prot ) pgprot_noncached( prot )
+#endif
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns true when a user mapping can get the memory attribute.
+ *
+ * On x86 with PAT remap_pfn_range() of RAM falls back to write-back for
+ * a write-combining or uncached request ("map pfn RAM range req ... got
+ * write-back"), the mapping would be cached silently. Changing the memory
+ * type of the buffer itself by set_memory_wc() would affect all mappings,
+ * contrary to an attribute per mmap().
+ */
+static bool mapAttrSupported( unsigned int mapAttr )
+{
+   if( IS_ENABLED( CONFIG_X86 ) )
+      return (mapAttr == DMATEST_USER_MAP_DEFAULT) || (mapAttr == DMATEST_USER_MAP_CACHED);
+   return true;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Maps coherent memory with the memory attribute of the session.
+ * @param mapAttr DMATEST_USER_MAP_DEFAULT, _CACHED, _WRITECOMBINE or
+ *                _UNCACHED
+ */
+static int mmapCoherent( struct vm_area_struct* pVma, void* pVirt, dma_addr_t dmaAddr,
+                         size_t size, unsigned int mapAttr )
+{
+   switch( mapAttr )
+   {
+      case DMATEST_USER_MAP_CACHED:
+      {
+         /*
+          * On platforms without cache coherent DMA the kernel maps
+          * coherent memory uncached, a cached alias would break it.
+          */
+         if( !dev_is_dma_coherent( global.pDev ) )
+            return -EINVAL;
+         break;
+      }
+      case DMATEST_USER_MAP_WRITECOMBINE:
+      {
+         /*
+          * dma_mmap_wc() keeps the attribute on coherent platforms and
+          * chooses write-combine on the others.
+          */
+         pVma->vm_page_prot = pgprot_writecombine( pVma->vm_page_prot );
+         return dma_mmap_wc( global.pDev, pVma, pVirt, dmaAddr, size );
+      }
+      case DMATEST_USER_MAP_UNCACHED:
+      {
+         pVma->vm_page_prot = pgprot_uncached( pVma->vm_page_prot );
+         break;
+      }
+      default: break;
+   }
+
+   return dma_mmap_coherent( global.pDev, pVma, pVirt, dmaAddr, size );
+}
+
+/****************** Pool of buffers of arbitrary size ************************/
+
+/*!----------------------------------------------------------------------------
+ * @brief Creates the pool in a coherent arena of poolSize bytes.
+ */
+static int poolCreate( void )
+{
+   int ret;
+
+   global.arenaSize = PAGE_ALIGN( poolSize );
+   global.pArenaVirt = dma_alloc_coherent( global.pDev, global.arenaSize, &global.arenaPhys,
+                                           GFP_KERNEL | __GFP_NOWARN );
+   if( global.pArenaVirt == NULL )
+      return -ENOMEM;
+
+   /*
+    * Page granularity, so each buffer can become mapped on its own.
+    */
+   global.pPool = gen_pool_create( PAGE_SHIFT, -1 );
+   if( global.pPool == NULL )
+   {
+      ret = -ENOMEM;
+      goto L_FREE;
+   }
+
+   ret = gen_pool_add_virt( global.pPool, (unsigned long)global.pArenaVirt,
+                            global.arenaPhys, global.arenaSize, -1 );
+   if( ret != 0 )
+   {
+      gen_pool_destroy( global.pPool );
+      global.pPool = NULL;
+      goto L_FREE;
+   }
+   return 0;
+
+L_FREE:
+   dma_free_coherent( global.pDev, global.arenaSize, global.pArenaVirt, global.arenaPhys );
+   global.pArenaVirt = NULL;
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void poolDestroy( void )
+{
+   if( global.pPool == NULL )
+      return;
+   gen_pool_destroy( global.pPool );
+   dma_free_coherent( global.pDev, global.arenaSize, global.pArenaVirt, global.arenaPhys );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Offset for mmap() of the pool buffer, the pool buffers follow
+ *        the DMA buffers.
+ */
+static u64 poolMmapOffset( const POOL_BUFFER_T* pBuffer )
+{
+   return global.size + (pBuffer->dmaAddr - global.arenaPhys);
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Implementation of DMATEST_USER_IOCTL_POOL_ALLOC
+ */
+static long poolAlloc( SESSION_T* pSession, DMATEST_USER_POOL_ALLOC_T __user* pArg )
+{
+   DMATEST_USER_POOL_ALLOC_T arg;
+   POOL_BUFFER_T* pBuffer;
+   int handle;
+
+   if( global.pPool == NULL )
+      return -ENODEV;
+
+   if( copy_from_user( &arg, pArg, sizeof( arg ) ) != 0 )
+      return -EFAULT;
+
+   if( (arg.size == 0) || (arg.size > global.arenaSize) )
+      return -EINVAL;
+
+   pBuffer = kzalloc( sizeof( POOL_BUFFER_T ), GFP_KERNEL );
+   if( pBuffer == NULL )
+      return -ENOMEM;
+
+   pBuffer->size = PAGE_ALIGN( arg.size );
+   pBuffer->pVirt = gen_pool_dma_alloc( global.pPool, pBuffer->size, &pBuffer->dmaAddr );
+   if( pBuffer->pVirt == NULL )
+   {
+      kfree( pBuffer );
+      return -ENOMEM;
+   }
+
+   mutex_lock( &pSession->poolMutex );
+   handle = idr_alloc( &pSession->poolBuffers, pBuffer, 1, 0, GFP_KERNEL );
+   if( handle < 0 )
+      goto L_FREE;
+
+   arg.size       = pBuffer->size;
+   arg.mmapOffset = poolMmapOffset( pBuffer );
+   arg.dmaAddress = pBuffer->dmaAddr;
+   arg.handle     = handle;
+   arg.reserved   = 0;
+   if( copy_to_user( pArg, &arg, sizeof( arg ) ) != 0 )
+   {
+      idr_remove( &pSession->poolBuffers, handle );
+      handle = -EFAULT;
+      goto L_FREE;
+   }
+   mutex_unlock( &pSession->poolMutex );
+   return 0;
+
+L_FREE:
+   mutex_unlock( &pSession->poolMutex );
+   gen_pool_free( global.pPool, (unsigned long)pBuffer->pVirt, pBuffer->size );
+   kfree( pBuffer );
+   return handle;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Implementation of DMATEST_USER_IOCTL_POOL_FREE
+ */
+static long poolFree( SESSION_T* pSession, u32 __user* pArg )
+{
+   POOL_BUFFER_T* pBuffer;
+   u32 handle;
+
+   if( get_user( handle, pArg ) != 0 )
+      return -EFAULT;
+
+   mutex_lock( &pSession->poolMutex );
+   pBuffer = idr_find( &pSession->poolBuffers, handle );
+   if( pBuffer == NULL )
+   {
+      mutex_unlock( &pSession->poolMutex );
+      return -EINVAL;
+   }
+   if( atomic_read( &pBuffer->mapCount ) != 0 )
+   {
+      mutex_unlock( &pSession->poolMutex );
+      return -EBUSY;
+   }
+   idr_remove( &pSession->poolBuffers, handle );
+   mutex_unlock( &pSession->poolMutex );
+
+   gen_pool_free( global.pPool, (unsigned long)pBuffer->pVirt, pBuffer->size );
+   kfree( pBuffer );
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Frees all pool buffers of the session when the file becomes
+ *        closed. No one is mapped anymore, because each mapping holds a
+ *        reference to the file.
+ */
+static void poolFreeAll( SESSION_T* pSession )
+{
+   POOL_BUFFER_T* pBuffer;
+   int handle;
+
+   idr_for_each_entry( &pSession->poolBuffers, pBuffer, handle )
+   {
+      gen_pool_free( global.pPool, (unsigned long)pBuffer->pVirt, pBuffer->size );
+      kfree( pBuffer );
+   }
+   idr_destroy( &pSession->poolBuffers );
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void onPoolVmOpen( struct vm_area_struct* pVma )
+{
+   atomic_inc( &((POOL_BUFFER_T*)pVma->vm_private_data)->mapCount );
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void onPoolVmClose( struct vm_area_struct* pVma )
+{
+   atomic_dec( &((POOL_BUFFER_T*)pVma->vm_private_data)->mapCount );
+}
+
+static const struct vm_operations_struct mg_poolVmOps =
+{
+   .open  = onPoolVmOpen,
+   .close = onPoolVmClose
+};
+
+/*!----------------------------------------------------------------------------
+ * @brief Maps the pool buffer which starts at the offset of the mapping.
+ */
+static int mmapPool( SESSION_T* pSession, struct vm_area_struct* pVma )
+{
+   POOL_BUFFER_T* pBuffer;
+   u64 offset = (u64)pVma->vm_pgoff << PAGE_SHIFT;
+   int handle;
+   int ret = -ENXIO;
+
+   mutex_lock( &pSession->poolMutex );
+   idr_for_each_entry( &pSession->poolBuffers, pBuffer, handle )
+   {
+      if( poolMmapOffset( pBuffer ) != offset )
+         continue;
+      if( (pVma->vm_end - pVma->vm_start) > pBuffer->size )
+         break;
+      /*
+       * dma_mmap_coherent() expects the offset relative to the buffer.
+       */
+      pVma->vm_pgoff = 0;
+      ret = mmapCoherent( pVma, pBuffer->pVirt, pBuffer->dmaAddr, pBuffer->size,
+                          pSession->mapAttr );
+      if( ret != 0 )
+         break;
+      pVma->vm_private_data = pBuffer;
+      pVma->vm_ops = &mg_poolVmOps;
+      onPoolVmOpen( pVma );
+      break;
+   }
+   mutex_unlock( &pSession->poolMutex );
+
+   if( ret != 0 )
+      ERROR_MESSAGE( "no pool buffer at offset %llu: %d\n", offset, ret );
+   return ret;
+}
+
+/****************** End pool of buffers of arbitrary size ********************/
+
+/****************** Export of buffers as dma-buf *****************************/
+
+/*!
+ * @brief Buffer exported as dma-buf, private data of the dma-buf.
+ * @see DMATEST_USER_IOCTL_EXPORT
+ */
+typedef struct
+{
+   /*! @brief Offset of the buffer in the DMA buffers. */
+   loff_t     offset;
+   void*      pVirt;
+   dma_addr_t dmaAddr;
+   size_t     size;
+} EXPORT_T;
+
+/*!----------------------------------------------------------------------------
+ * @brief Creates the scatter-gather table of the buffer for the attached
+ *        device, it becomes mapped by onDmaBufMap().
+ */
+static int onDmaBufAttach( struct dma_buf* pDmaBuf, struct dma_buf_attachment* pAttach )
+{
+   EXPORT_T* pExport = pDmaBuf->priv;
+   struct sg_table* pSgTable;
+   int ret;
+
+   pSgTable = kzalloc( sizeof( struct sg_table ), GFP_KERNEL );
+   if( pSgTable == NULL )
+      return -ENOMEM;
+
+   if( global.layout == LAYOUT_STREAMING )
+   {
+      ret = sg_alloc_table( pSgTable, 1, GFP_KERNEL );
+      if( ret == 0 )
+         sg_set_page( pSgTable->sgl, virt_to_page( pExport->pVirt ), pExport->size, 0 );
+   }
+   else
+   {
+      ret = dma_get_sgtable( global.pDev, pSgTable, pExport->pVirt, pExport->dmaAddr,
+                             pExport->size );
+   }
+   if( ret != 0 )
+   {
+      kfree( pSgTable );
+      return ret;
+   }
+
+   pAttach->priv = pSgTable;
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void onDmaBufDetach( struct dma_buf* pDmaBuf, struct dma_buf_attachment* pAttach )
+{
+   sg_free_table( pAttach->priv );
+   kfree( pAttach->priv );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Maps the buffer for the attached device.
+ */
+static struct sg_table* onDmaBufMap( struct dma_buf_attachment* pAttach,
+                                     enum dma_data_direction dir )
+{
+   struct sg_table* pSgTable = pAttach->priv;
+   int ret;
+
+   ret = dma_map_sgtable( pAttach->dev, pSgTable, dir, 0 );
+   if( ret != 0 )
+      return ERR_PTR( ret );
+   return pSgTable;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void onDmaBufUnmap( struct dma_buf_attachment* pAttach,
+                           struct sg_table* pSgTable,
+                           enum dma_data_direction dir )
+{
+   dma_unmap_sgtable( pAttach->dev, pSgTable, dir, 0 );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Becomes invoked when the last reference of the dma-buf has
+ *        been dropped.
+ */
+static void onDmaBufRelease( struct dma_buf* pDmaBuf )
+{
+   kfree( pDmaBuf->priv );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief mmap() of the dma-buf file descriptor, the dma-buf core has
+ *        already checked offset and length.
+ */
+static int onDmaBufMmap( struct dma_buf* pDmaBuf, struct vm_area_struct* pVma )
+{
+   EXPORT_T* pExport = pDmaBuf->priv;
+
+   if( global.layout == LAYOUT_STREAMING )
+   {
+      return remap_pfn_range( pVma, pVma->vm_start,
+                              (virt_to_phys( pExport->pVirt ) >> PAGE_SHIFT) + pVma->vm_pgoff,
+                              pVma->vm_end - pVma->vm_start, pVma->vm_page_prot );
+   }
+
+   return dma_mmap_coherent( global.pDev, pVma, pExport->pVirt, pExport->dmaAddr,
+                             pExport->size );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief DMA_BUF_IOCTL_SYNC with DMA_BUF_SYNC_START
+ */
+static int onDmaBufBeginCpuAccess( struct dma_buf* pDmaBuf, enum dma_data_direction dir )
+{
+   EXPORT_T* pExport = pDmaBuf->priv;
+
+   bufferSync( pExport->offset, pExport->size, true );
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief DMA_BUF_IOCTL_SYNC with DMA_BUF_SYNC_END
+ */
+static int onDmaBufEndCpuAccess( struct dma_buf* pDmaBuf, enum dma_data_direction dir )
+{
+   EXPORT_T* pExport = pDmaBuf->priv;
+
+   bufferSync( pExport->offset, pExport->size, false );
+   return 0;
+}
+
+static const struct dma_buf_ops mg_dmaBufOps =
+{
+   .attach           = onDmaBufAttach,
+   .detach           = onDmaBufDetach,
+   .map_dma_buf      = onDmaBufMap,
+   .unmap_dma_buf    = onDmaBufUnmap,
+   .release          = onDmaBufRelease,
+   .mmap             = onDmaBufMmap,
+   .begin_cpu_access = onDmaBufBeginCpuAccess,
+   .end_cpu_access   = onDmaBufEndCpuAccess
+};
+
+/*!----------------------------------------------------------------------------
+ * @brief Implementation of DMATEST_USER_IOCTL_EXPORT
+ *
+ * The dma-buf holds a reference of this module, so the buffer can't
+ * disappear before the dma-buf.
+ */
+static long exportDmaBuf( DMATEST_USER_EXPORT_T __user* pArg )
+{
+   DEFINE_DMA_BUF_EXPORT_INFO( exportInfo );
+   DMATEST_USER_EXPORT_T arg;
+   EXPORT_T* pExport;
+   struct dma_buf* pDmaBuf;
+   int fd;
+
+   if( copy_from_user( &arg, pArg, sizeof( arg ) ) != 0 )
+      return -EFAULT;
+
+   if( (arg.index >= global.count) || ((arg.flags & ~O_CLOEXEC) != 0) )
+      return -EINVAL;
+
+   /*
+    * A buffer of chunks would need its own scatter-gather handling.
+    */
+   if( global.layout == LAYOUT_CHUNKED )
+      return -EOPNOTSUPP;
+
+   pExport = kzalloc( sizeof( EXPORT_T ), GFP_KERNEL );
+   if( pExport == NULL )
+      return -ENOMEM;
+
+   pExport->offset  = (loff_t)arg.index * global.bufferSize;
+   pExport->pVirt   = global.pDmaVirt + pExport->offset;
+   pExport->dmaAddr = global.pDmaPhys + pExport->offset;
+   pExport->size    = global.bufferSize;
+
+   exportInfo.ops   = &mg_dmaBufOps;
+   exportInfo.size  = pExport->size;
+   exportInfo.flags = O_RDWR;
+   exportInfo.priv  = pExport;
+   pDmaBuf = dma_buf_export( &exportInfo );
+   if( IS_ERR( pDmaBuf ) )
+   {
+      kfree( pExport );
+      return PTR_ERR( pDmaBuf );
+   }
+
+   /*
+    * The file descriptor becomes installed not until the caller knows it,
+    * otherwise a failing copy_to_user() would leave it open unnoticed.
+    */
+   fd = get_unused_fd_flags( arg.flags );
+   if( fd < 0 )
+   {
+      /*
+       * Frees pExport by onDmaBufRelease().
+       */
+      dma_buf_put( pDmaBuf );
+      return fd;
+   }
+
+   arg.fd = fd;
+   if( copy_to_user( pArg, &arg, sizeof( arg ) ) != 0 )
+   {
+      put_unused_fd( fd );
+      dma_buf_put( pDmaBuf );
+      return -EFAULT;
+   }
+
+   fd_install( fd, pDmaBuf->file );
+   return 0;
+}
+
+/****************** End export of buffers as dma-buf *************************/
+
+/*!----------------------------------------------------------------------------
+ * @brief Copies between the buffer and the user-space.
+ *
+ * In the layouts LAYOUT_CHUNKED and LAYOUT_STREAMING the pages are cacheable
+ * and become synchronized with the device for the copied range.
+ * @param toUser true: from buffer to user-space; false: vice versa.
+ * @return 0 or -EFAULT
+ */
+static int bufferCopy( loff_t offset, void __user* pUser, size_t len, bool toUser )
+{
+   struct scatterlist* pSg;
+   int i;
+
+   if( global.layout != LAYOUT_CHUNKED )
+   {
+      if( toUser )
+      {
+         bufferSync( offset, len, true );
+         return (copy_to_user( pUser, global.pDmaVirt + offset, len ) != 0)? -EFAULT : 0;
+      }
+      if( copy_from_user( global.pDmaVirt + offset, pUser, len ) != 0 )
+         return -EFAULT;
+      bufferSync( offset, len, false );
+      return 0;
+   }
+
+   for_each_sgtable_sg( &global.sgTable, pSg, i )
+   {
+      size_t n;
+      void* pVirt;
+
+      if( len == 0 )
+         break;
+      if( offset >= pSg->length )
+      {
+         offset -= pSg->length;
+         continue;
+      }
+      n = min_t( size_t, len, pSg->length - offset );
+      pVirt = page_address( sg_page( pSg ) ) + offset;
+      if( toUser )
+      {
+         dma_sync_single_range_for_cpu( global.pDev, sg_dma_address( pSg ), offset, n,
+                                        DMA_BIDIRECTIONAL );
+         if( copy_to_user( pUser, pVirt, n ) != 0 )
+            return -EFAULT;
+      }
+      else
+      {
+         if( copy_from_user( pVirt, pUser, n ) != 0 )
+            return -EFAULT;
+         dma_sync_single_range_for_device( global.pDev, sg_dma_address( pSg ), offset, n,
+                                           DMA_BIDIRECTIONAL );
+      }
+      pUser += n;
+      len -= n;
+      offset = 0;
+   }
+
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static int onOpen( struct inode* pInode, struct file* pFile )
+{
+   SESSION_T* pSession;
+
+   DEBUG_MESSAGE( "minor: %d\n", iminor( pInode ) );
+
+   pSession = kzalloc( sizeof( SESSION_T ), GFP_KERNEL );
+   if( pSession == NULL )
+      return -ENOMEM;
+
+   mutex_init( &pSession->poolMutex );
+   idr_init( &pSession->poolBuffers );
+
+   pFile->private_data = pSession;
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static int onRelease( struct inode* pInode, struct file* pFile )
+{
+   SESSION_T* pSession = pFile->private_data;
+
+   DEBUG_MESSAGE( "minor: %d\n", iminor( pInode ) );
+
+   poolFreeAll( pSession );
+   mutex_destroy( &pSession->poolMutex );
+   kfree( pSession );
+   return 0;
+}
+
 /*!----------------------------------------------------------------------------
  */
 static ssize_t onRead( struct file* pFile,
@@ -64,14 +1068,14 @@ static ssize_t onRead( struct file* pFile,
                        size_t len,
                        loff_t* pOffset )
 {
-   DEBUG_MESSAGE( "minor: %d\n", ((struct miscdevice*)pFile->private_data)->minor );
-   if( *pOffset >= DMA_BUFFER_SIZE )
+   DEBUG_MESSAGE( "minor: %d\n", iminor( file_inode( pFile ) ) );
+   if( *pOffset >= global.size )
       return 0;
 
-   if( len > DMA_BUFFER_SIZE - *pOffset )
-      len = DMA_BUFFER_SIZE - *pOffset;
+   if( len > global.size - *pOffset )
+      len = global.size - *pOffset;
 
-   if( copy_to_user( pUserBuffer, global.pDmaVirt + *pOffset, len ) != 0 )
+   if( bufferCopy( *pOffset, pUserBuffer, len, true ) != 0 )
    {
       ERROR_MESSAGE( "copy_to_user\n" );
       return -EFAULT;
@@ -87,17 +1091,17 @@ static ssize_t onWrite( struct file *pFile,
                         size_t len,
                         loff_t* pOffset )
 {
-   DEBUG_MESSAGE( "minor: %d\n", ((struct miscdevice*)pFile->private_data)->minor );
-   if( *pOffset >= DMA_BUFFER_SIZE )
+   DEBUG_MESSAGE( "minor: %d\n", iminor( file_inode( pFile ) ) );
+   if( *pOffset >= global.size )
    {
-      ERROR_MESSAGE( "*pOffset >= DMA_BUFFER_SIZE\n" );
+      ERROR_MESSAGE( "*pOffset >= buffer size\n" );
       return -ENOMEM;
    }
 
-   if( len > DMA_BUFFER_SIZE - *pOffset )
-      len = DMA_BUFFER_SIZE - *pOffset;
+   if( len > global.size - *pOffset )
+      len = global.size - *pOffset;
 
-   if( copy_from_user( global.pDmaVirt + *pOffset, pUserBuffer, len ) != 0 )
+   if( bufferCopy( *pOffset, (void __user*)pUserBuffer, len, false ) != 0 )
    {
       ERROR_MESSAGE( "copy_from_user\n" );
       return -EFAULT;
@@ -108,33 +1112,378 @@ static ssize_t onWrite( struct file *pFile,
 }
 
 /*!----------------------------------------------------------------------------
+ * @brief Maps the chunks of layout LAYOUT_CHUNKED one after another into
+ *        the user-space, so the process sees one contiguous buffer.
+ * @note The pages of the chunks are cacheable memory.
+ */
+static int mmapChunks( struct vm_area_struct* pVma )
+{
+   struct scatterlist* pSg;
+   unsigned long offset = pVma->vm_pgoff << PAGE_SHIFT;
+   unsigned long address = pVma->vm_start;
+   int i;
+   int ret;
+
+   for_each_sgtable_sg( &global.sgTable, pSg, i )
+   {
+      unsigned long len;
+
+      if( address >= pVma->vm_end )
+         break;
+      if( offset >= pSg->length )
+      {
+         offset -= pSg->length;
+         continue;
+      }
+      len = min_t( unsigned long, pSg->length - offset, pVma->vm_end - address );
+      ret = remap_pfn_range( pVma, address,
+                             page_to_pfn( sg_page( pSg ) ) + (offset >> PAGE_SHIFT),
+                             len, pVma->vm_page_prot );
+      if( ret != 0 )
+         return ret;
+      address += len;
+      offset = 0;
+   }
+
+   return 0;
+}
+
+#ifdef CONFIG_DMATEST_HUGE_PFNMAP
+/*!----------------------------------------------------------------------------
+ * @brief Returns the page frame number of the given buffer offset, when
+ *        the range of len bytes from there lies in one chunk and the frame
+ *        is aligned to len, otherwise 0.
+ */
+static unsigned long chunkPfn( unsigned long offset, unsigned long len )
+{
+   struct scatterlist* pSg;
+   unsigned long pfn;
+   int i;
+
+   for_each_sgtable_sg( &global.sgTable, pSg, i )
+   {
+      if( offset >= pSg->length )
+      {
+         offset -= pSg->length;
+         continue;
+      }
+      if( len > pSg->length - offset )
+         return 0;
+      pfn = page_to_pfn( sg_page( pSg ) ) + (offset >> PAGE_SHIFT);
+      if( !IS_ALIGNED( pfn, len >> PAGE_SHIFT ) )
+         return 0;
+      return pfn;
+   }
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Fault handler of huge-page mappings: inserts one PMD mapping of
+ *        2 MiB, otherwise the kernel falls back to onFault().
+ */
+static vm_fault_t onHugeFault( struct vm_fault* pVmf, unsigned int order )
+{
+   struct vm_area_struct* pVma = pVmf->vma;
+   unsigned long address = pVmf->address & PMD_MASK;
+   unsigned long pfn;
+
+   if( (order != PMD_ORDER) || (address < pVma->vm_start) ||
+       (address + PMD_SIZE > pVma->vm_end) )
+      return VM_FAULT_FALLBACK;
+
+   pfn = chunkPfn( (address - pVma->vm_start) + (pVma->vm_pgoff << PAGE_SHIFT), PMD_SIZE );
+   if( pfn == 0 )
+      return VM_FAULT_FALLBACK;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 17, 0)
+   return vmf_insert_pfn_pmd( pVmf, pfn, (pVmf->flags & FAULT_FLAG_WRITE) != 0 );
+#else
+   return vmf_insert_pfn_pmd( pVmf, __pfn_to_pfn_t( pfn, PFN_DEV ),
+                              (pVmf->flags & FAULT_FLAG_WRITE) != 0 );
+#endif
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Fault handler of huge-page mappings for single 4 KiB pages.
+ */
+static vm_fault_t onFault( struct vm_fault* pVmf )
+{
+   unsigned long pfn = chunkPfn( pVmf->pgoff << PAGE_SHIFT, PAGE_SIZE );
+
+   if( pfn == 0 )
+      return VM_FAULT_SIGBUS;
+
+   return vmf_insert_pfn( pVmf->vma, pVmf->address, pfn );
+}
+
+static const struct vm_operations_struct mg_hugeVmOps =
+{
+   .fault      = onFault,
+   .huge_fault = onHugeFault
+};
+
+/*!----------------------------------------------------------------------------
+ * @brief Prepares a huge-page mapping, the pages become inserted on demand
+ *        by onHugeFault() respectively onFault().
+ */
+static int mmapHuge( struct vm_area_struct* pVma )
+{
+   /*
+    * PFN mappings can't be copied on write.
+    */
+   if( is_cow_mapping( pVma->vm_flags ) )
+      return -EINVAL;
+
+   vm_flags_set( pVma, VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP );
+   pVma->vm_ops = &mg_hugeVmOps;
+   return 0;
+}
+#endif /* ifdef CONFIG_DMATEST_HUGE_PFNMAP */
+
+/*!----------------------------------------------------------------------------
+ * @brief Maps the cacheable buffer of layout LAYOUT_STREAMING into the
+ *        user-space.
+ */
+static int mmapStreaming( struct vm_area_struct* pVma )
+{
+   unsigned long offset = pVma->vm_pgoff << PAGE_SHIFT;
+   unsigned long len = pVma->vm_end - pVma->vm_start;
+
+   return remap_pfn_range( pVma, pVma->vm_start,
+                           virt_to_phys( global.pDmaVirt + offset ) >> PAGE_SHIFT,
+                           len, pVma->vm_page_prot );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Maps one or more consecutive buffers, the offset selects the
+ *        first buffer: n * global.bufferSize.
+ *        Offsets from global.size on select a pool buffer.
  */
 static int onMmap( struct file* pFile, struct vm_area_struct* pVma )
 {
+    unsigned long len = pVma->vm_end - pVma->vm_start;
+    SESSION_T* pSession = pFile->private_data;
+    unsigned long offset;
     int ret;
 
-    DEBUG_MESSAGE( "minor: %d\n", ((struct miscdevice*)pFile->private_data)->minor );
-    INFO_MESSAGE( "size = %lu\n", pVma->vm_end - pVma->vm_start);
+    DEBUG_MESSAGE( "minor: %d\n", iminor( file_inode( pFile ) ) );
+    if( pVma->vm_pgoff >= (global.size >> PAGE_SHIFT) )
+       return mmapPool( pSession, pVma );
+
+    /*
+     * Below global.size now, so the shift can't overflow.
+     */
+    offset = pVma->vm_pgoff << PAGE_SHIFT;
+    INFO_MESSAGE( "buffer %lu, size = %lu\n", offset / global.bufferSize, len );
+
+    if( len > (global.size - offset) )
+    {
+       ERROR_MESSAGE( "offset %lu, size %lu exceeds the buffers of %zu bytes\n",
+                      offset, len, global.size );
+       return -ENXIO;
+    }
+
+    /*
+     * Cacheable memory becomes mapped cached only, another attribute
+     * would be a mismatched alias of the kernel's linear mapping.
+     */
+    if( (global.layout != LAYOUT_CONTIGUOUS) &&
+        (pSession->mapAttr != DMATEST_USER_MAP_DEFAULT) &&
+        (pSession->mapAttr != DMATEST_USER_MAP_CACHED) )
+    {
+       ERROR_MESSAGE( "cacheable memory can be mapped cached only\n" );
+       return -EINVAL;
+    }
 
-    ret = dma_mmap_coherent( global.pDev, pVma, global.pDmaVirt, global.pDmaPhys, DMA_BUFFER_SIZE );
+#ifdef CONFIG_DMATEST_HUGE_PFNMAP
+    if( hugePages )
+       return mmapHuge( pVma );
+#endif
+    if( global.layout == LAYOUT_CHUNKED )
+       return mmapChunks( pVma );
+
+    if( global.layout == LAYOUT_STREAMING )
+       return mmapStreaming( pVma );
+
+    ret = mmapCoherent( pVma, global.pDmaVirt, global.pDmaPhys, global.size, pSession->mapAttr );
     if( ret != 0 )
-        ERROR_MESSAGE("dma_mmap_coherent failed: %d\n", ret );
+        ERROR_MESSAGE( "mmapCoherent failed: %d\n", ret );
     return ret;
 }
 
+/*!----------------------------------------------------------------------------
+ */
+static long onIoctl( struct file* pFile, unsigned int cmd, unsigned long arg )
+{
+   DMATEST_USER_RANGE_T range;
+   DMATEST_USER_GEOMETRY_T geometry;
+   unsigned int mapAttr;
+
+   DEBUG_MESSAGE( "minor: %d\n", iminor( file_inode( pFile ) ) );
+   switch( cmd )
+   {
+      case DMATEST_USER_IOCTL_SYNC_FOR_CPU:
+      case DMATEST_USER_IOCTL_SYNC_FOR_DEVICE:
+      {
+         if( copy_from_user( &range, (void __user*)arg, sizeof( range ) ) != 0 )
+            return -EFAULT;
+         if( (range.length > global.size) || (range.offset > global.size - range.length) )
+            return -EINVAL;
+         bufferSync( range.offset, range.length, cmd == DMATEST_USER_IOCTL_SYNC_FOR_CPU );
+         return 0;
+      }
+      case DMATEST_USER_IOCTL_GET_GEOMETRY:
+      {
+         memset( &geometry, 0, sizeof( geometry ) );
+         geometry.bufferSize = global.bufferSize;
+         geometry.totalSize  = global.size;
+         geometry.count      = global.count;
+         geometry.layout     = global.layout;
+         if( copy_to_user( (void __user*)arg, &geometry, sizeof( geometry ) ) != 0 )
+            return -EFAULT;
+         return 0;
+      }
+      case DMATEST_USER_IOCTL_POOL_ALLOC:
+      {
+         return poolAlloc( pFile->private_data, (void __user*)arg );
+      }
+      case DMATEST_USER_IOCTL_POOL_FREE:
+      {
+         return poolFree( pFile->private_data, (void __user*)arg );
+      }
+      case DMATEST_USER_IOCTL_SET_MAP_ATTR:
+      {
+         if( get_user( mapAttr, (unsigned int __user*)arg ) != 0 )
+            return -EFAULT;
+         if( mapAttr > DMATEST_USER_MAP_UNCACHED )
+            return -EINVAL;
+         if( !mapAttrSupported( mapAttr ) )
+            return -EOPNOTSUPP;
+         ((SESSION_T*)pFile->private_data)->mapAttr = mapAttr;
+         return 0;
+      }
+      case DMATEST_USER_IOCTL_EXPORT:
+      {
+         return exportDmaBuf( (void __user*)arg );
+      }
+   }
+
+   return -ENOTTY;
+}
+
 static const struct file_operations mg_fops =
 {
-   .owner = THIS_MODULE,
-   .read  = onRead,
-   .write = onWrite,
-   .mmap  = onMmap
+   .owner          = THIS_MODULE,
+   .open           = onOpen,
+   .release        = onRelease,
+   .read           = onRead,
+   .write          = onWrite,
+   .mmap           = onMmap,
+#ifdef CONFIG_DMATEST_HUGE_PFNMAP
+   /*
+    * Aligns the virtual address of the mapping to PMD_SIZE.
+    */
+   .get_unmapped_area = thp_get_unmapped_area,
+#endif
+   .unlocked_ioctl = onIoctl
+};
+
+/****************** Device attribut functions ********************************/
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/misc/dmatest_user/layout
+ * Output: "contiguous", "chunked" or "streaming"
+ */
+static ssize_t layout_show( struct device* pDev,
+                            struct device_attribute* pAttr, char* pBuf )
+{
+   static const char* names[] =
+   {
+      [LAYOUT_CONTIGUOUS] = "contiguous",
+      [LAYOUT_CHUNKED]    = "chunked",
+      [LAYOUT_STREAMING]  = "streaming"
+   };
+
+   return sysfs_emit( pBuf, "%s\n", names[global.layout] );
+}
+
+static DEVICE_ATTR_RO( layout );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/misc/dmatest_user/size
+ */
+static ssize_t size_show( struct device* pDev,
+                          struct device_attribute* pAttr, char* pBuf )
+{
+   return sysfs_emit( pBuf, "%zu\n", global.size );
+}
+
+static DEVICE_ATTR_RO( size );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/misc/dmatest_user/chunks
+ * Output: one line "<dma-address> <length>" per physically contiguous chunk.
+ */
+static ssize_t chunks_show( struct device* pDev,
+                            struct device_attribute* pAttr, char* pBuf )
+{
+   struct scatterlist* pSg;
+   int len = 0;
+   int i;
+
+   if( global.layout != LAYOUT_CHUNKED )
+      return sysfs_emit( pBuf, "%pad %zu\n", &global.pDmaPhys, global.size );
+
+   for_each_sgtable_dma_sg( &global.sgTable, pSg, i )
+   {
+      /*
+       * Room for one further line, otherwise the list becomes truncated.
+       */
+      if( len > (PAGE_SIZE - 48) )
+         break;
+      len += sysfs_emit_at( pBuf, len, "%pad %u\n",
+                            &sg_dma_address( pSg ), sg_dma_len( pSg ) );
+   }
+   return len;
+}
+
+static DEVICE_ATTR_RO( chunks );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/misc/dmatest_user/pool
+ * Output: "<arena size> <available bytes>", "0 0" without pool.
+ */
+static ssize_t pool_show( struct device* pDev,
+                          struct device_attribute* pAttr, char* pBuf )
+{
+   if( global.pPool == NULL )
+      return sysfs_emit( pBuf, "0 0\n" );
+
+   return sysfs_emit( pBuf, "%zu %zu\n", gen_pool_size( global.pPool ),
+                      gen_pool_avail( global.pPool ) );
+}
+
+static DEVICE_ATTR_RO( pool );
+
+static struct attribute* dma_attrs[] =
+{
+   &dev_attr_layout.attr,
+   &dev_attr_size.attr,
+   &dev_attr_chunks.attr,
+   &dev_attr_pool.attr,
+   NULL
 };
 
+ATTRIBUTE_GROUPS( dma );
+
+/****************** End device attribut functions ****************************/
+
 static struct miscdevice mg_miscdev =
 {
    .minor = MISC_DYNAMIC_MINOR,
    .name  = DEVICE_BASE_FILE_NAME,
-   .fops  = &mg_fops
+   .fops   = &mg_fops,
+   .groups = dma_groups
 };
 
 /*!----------------------------------------------------------------------------
@@ -158,15 +1507,57 @@ static int __init driverInit( void )
        global.pDev->dma_mask = &global.pDev->coherent_dma_mask;
    global.pDev->coherent_dma_mask = DMA_BIT_MASK(32);  // oder 64, je nach Plattform
 
-   global.pDmaVirt = dma_alloc_coherent( global.pDev, DMA_BUFFER_SIZE, &global.pDmaPhys, GFP_KERNEL );
-   if( global.pDmaVirt == NULL )
+   global.bufferSize = hugePages? ALIGN( bufferSize, PMD_SIZE ) : PAGE_ALIGN( bufferSize );
+   if( global.bufferSize == 0 )
    {
-      ERROR_MESSAGE( "dma_alloc_coherent\n" );
+      ERROR_MESSAGE( "bufferSize: 0\n" );
       misc_deregister( &mg_miscdev );
-      return -ENOMEM;
+      return -EINVAL;
+   }
+   if( (bufferCount == 0) || (bufferCount > MAX_BUFFER_COUNT) )
+   {
+      ERROR_MESSAGE( "bufferCount: %u, allowed: 1..%u\n", bufferCount, MAX_BUFFER_COUNT );
+      misc_deregister( &mg_miscdev );
+      return -EINVAL;
+   }
+   if( check_mul_overflow( global.bufferSize, (size_t)bufferCount, &global.size ) )
+   {
+      misc_deregister( &mg_miscdev );
+      return -EINVAL;
+   }
+   global.count = bufferCount;
+
+   ret = bufferAlloc();
+   if( ret != 0 )
+   {
+      ERROR_MESSAGE( "unable to allocate %zu bytes\n", global.size );
+      misc_deregister( &mg_miscdev );
+      return ret;
    }
 
-   INFO_MESSAGE(" loaded, virt=0x%p, phys=%pad\n", global.pDmaVirt, &global.pDmaPhys );
+   if( poolSize > 0 )
+   {
+      ret = poolCreate();
+      if( ret != 0 )
+      {
+         ERROR_MESSAGE( "unable to allocate the pool of %lu bytes\n", poolSize );
+         bufferFree();
+         misc_deregister( &mg_miscdev );
+         return ret;
+      }
+      INFO_MESSAGE( "pool of %zu bytes, phys=%pad\n", global.arenaSize, &global.arenaPhys );
+   }
+
+#ifndef CONFIG_DMATEST_HUGE_PFNMAP
+   if( hugePages )
+      INFO_MESSAGE( "no PMD mappings of PFN ranges in this kernel, mapping 4 KiB pages\n" );
+#endif
+   if( global.layout == LAYOUT_CHUNKED )
+      INFO_MESSAGE(" loaded, %u * %zu bytes in %u chunks\n", global.count, global.bufferSize,
+                   global.sgTable.nents );
+   else
+      INFO_MESSAGE(" loaded, %u * %zu bytes, virt=0x%p, phys=%pad\n", global.count,
+                   global.bufferSize, global.pDmaVirt, &global.pDmaPhys );
    return 0;
 }
 
@@ -177,8 +1568,9 @@ static void __exit driverExit( void )
 {
    DEBUG_MESSAGE( "\n" );
 
-   dma_free_coherent(global.pDev, DMA_BUFFER_SIZE, global.pDmaVirt, global.pDmaPhys);
    misc_deregister( &mg_miscdev );
+   poolDestroy();
+   bufferFree();
 }
 
 module_init( driverInit );
@@ -18,12 +18,22 @@
 #include <linux/delay.h>
 #include <linux/poll.h>
 #include <linux/dma-mapping.h>
+#include <linux/dma-map-ops.h>
+#include <linux/dma-buf.h>
+#include <linux/file.h>
+#include <linux/slab.h>
+#include <linux/version.h>
 
 #include <stdbool.h>
 
 #include <flip_dma_ctl.h>
 
 MODULE_LICENSE("GPL");
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+MODULE_IMPORT_NS( "DMA_BUF" );
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+MODULE_IMPORT_NS( DMA_BUF );
+#endif
 
 #define CONFIG_DEBUG_SKELETON
 #define DEVICE_BASE_FILE_NAME KBUILD_MODNAME
@@ -68,12 +78,34 @@ struct GLOBAL_T
    struct DMA_FLIP_BUFFER_T oDmaFlip;
 };
 
+/*
+ * Opened file.
+ */
+struct FILE_T
+{
+   /*
+    * Memory attribute of the following mmap() calls,
+    * see DMAFLIP_IOCTL_SET_MAP_ATTR.
+    */
+   unsigned int mapAttr;
+};
+
 static struct GLOBAL_T global =
 {
    .oDmaFlip.sequence = 0,
    .oDmaFlip.dataReady = false
 };
 
+/*
+ * On ARM pgprot_noncached() is device memory, which faults on the unaligned
+ * accesses of memcpy(), pgprot_writecombine() is Normal non-cacheable there.
+ */
+#if defined( CONFIG_ARM64 ) || defined( CONFIG_ARM )
+ #define pgprot_uncached( prot ) pgprot_writecombine( prot )
+#else
+ #define pgprot_uncached( prot ) pgprot_noncached( prot )
+#endif
+
 /*-----------------------------------------------------------------------------
  */
 static int onMmap( struct file* pFile, struct vm_area_struct* pVma )
@@ -86,11 +118,43 @@ static int onMmap( struct file* pFile, struct vm_area_struct* pVma )
       return -EINVAL;
    }
 
-   int ret = dma_mmap_coherent( global.miscdev.this_device,
-                                pVma,
-                                global.oDmaFlip.pDmaBuffers[0],
-                                global.oDmaFlip.dmaHandlers[0],
-                                BUFFER_SIZE * NUM_BUFFERS );
+   struct FILE_T* pFileData = pFile->private_data;
+   int ret;
+   switch( pFileData->mapAttr )
+   {
+      case DMAFLIP_MAP_CACHED:
+      {  /*
+          * On platforms without cache coherent DMA the kernel maps
+          * coherent memory uncached, a cached alias would break it.
+          */
+         if( !dev_is_dma_coherent( global.miscdev.this_device ) )
+            return -EINVAL;
+         break;
+      }
+      case DMAFLIP_MAP_WRITECOMBINE:
+      {
+         pVma->vm_page_prot = pgprot_writecombine( pVma->vm_page_prot );
+         break;
+      }
+      case DMAFLIP_MAP_UNCACHED:
+      {
+         pVma->vm_page_prot = pgprot_uncached( pVma->vm_page_prot );
+         break;
+      }
+   }
+
+   if( pFileData->mapAttr == DMAFLIP_MAP_WRITECOMBINE )
+      ret = dma_mmap_wc( global.miscdev.this_device,
+                         pVma,
+                         global.oDmaFlip.pDmaBuffers[0],
+                         global.oDmaFlip.dmaHandlers[0],
+                         BUFFER_SIZE * NUM_BUFFERS );
+   else
+      ret = dma_mmap_coherent( global.miscdev.this_device,
+                               pVma,
+                               global.oDmaFlip.pDmaBuffers[0],
+                               global.oDmaFlip.dmaHandlers[0],
+                               BUFFER_SIZE * NUM_BUFFERS );
    if( ret != 0 )
    {
       ERROR_MESSAGE( "dma_mmap_coherent failed: %d\n", ret );
@@ -112,6 +176,133 @@ static unsigned int onPoll( struct file* pFile, poll_table* pPollTable )
    return 0;
 }
 
+/*-----------------------------------------------------------------------------
+ * Creates the scatter-gather table of the flip buffers for the attached
+ * device.
+ */
+static int onDmaBufAttach( struct dma_buf* pDmaBuf, struct dma_buf_attachment* pAttach )
+{
+   struct sg_table* pSgTable = kzalloc( sizeof( struct sg_table ), GFP_KERNEL );
+   if( pSgTable == NULL )
+      return -ENOMEM;
+
+   int ret = dma_get_sgtable( global.miscdev.this_device, pSgTable,
+                              global.oDmaFlip.pDmaBuffers[0],
+                              global.oDmaFlip.dmaHandlers[0],
+                              TOTAL_BUFFER_SIZE );
+   if( ret != 0 )
+   {
+      kfree( pSgTable );
+      return ret;
+   }
+   pAttach->priv = pSgTable;
+   return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ */
+static void onDmaBufDetach( struct dma_buf* pDmaBuf, struct dma_buf_attachment* pAttach )
+{
+   sg_free_table( pAttach->priv );
+   kfree( pAttach->priv );
+}
+
+/*-----------------------------------------------------------------------------
+ */
+static struct sg_table* onDmaBufMap( struct dma_buf_attachment* pAttach,
+                                     enum dma_data_direction dir )
+{
+   int ret = dma_map_sgtable( pAttach->dev, pAttach->priv, dir, 0 );
+   if( ret != 0 )
+      return ERR_PTR( ret );
+   return pAttach->priv;
+}
+
+/*-----------------------------------------------------------------------------
+ */
+static void onDmaBufUnmap( struct dma_buf_attachment* pAttach,
+                           struct sg_table* pSgTable,
+                           enum dma_data_direction dir )
+{
+   dma_unmap_sgtable( pAttach->dev, pSgTable, dir, 0 );
+}
+
+/*-----------------------------------------------------------------------------
+ * The flip buffers are global and live as long as the module, which is
+ * referenced by each dma-buf.
+ */
+static void onDmaBufRelease( struct dma_buf* pDmaBuf )
+{
+   DEBUG_MESSAGE( "\n" );
+}
+
+/*-----------------------------------------------------------------------------
+ */
+static int onDmaBufMmap( struct dma_buf* pDmaBuf, struct vm_area_struct* pVma )
+{
+   return dma_mmap_coherent( global.miscdev.this_device,
+                             pVma,
+                             global.oDmaFlip.pDmaBuffers[0],
+                             global.oDmaFlip.dmaHandlers[0],
+                             TOTAL_BUFFER_SIZE );
+}
+
+/*
+ * The flip buffers are coherent memory, so begin_cpu_access and
+ * end_cpu_access aren't necessary.
+ */
+static const struct dma_buf_ops dmaflip_dmaBufOps =
+{
+   .attach        = onDmaBufAttach,
+   .detach        = onDmaBufDetach,
+   .map_dma_buf   = onDmaBufMap,
+   .unmap_dma_buf = onDmaBufUnmap,
+   .release       = onDmaBufRelease,
+   .mmap          = onDmaBufMmap
+};
+
+/*-----------------------------------------------------------------------------
+ */
+static long exportDmaBuf( DMAFLIP_EXPORT_T __user* pArg )
+{
+   DMAFLIP_EXPORT_T arg;
+   if( copy_from_user( &arg, pArg, sizeof( arg ) ) != 0 )
+      return -EFAULT;
+   if( (arg.flags & ~O_CLOEXEC) != 0 )
+      return -EINVAL;
+
+   DEFINE_DMA_BUF_EXPORT_INFO( exportInfo );
+   exportInfo.ops   = &dmaflip_dmaBufOps;
+   exportInfo.size  = TOTAL_BUFFER_SIZE;
+   exportInfo.flags = O_RDWR;
+   struct dma_buf* pDmaBuf = dma_buf_export( &exportInfo );
+   if( IS_ERR( pDmaBuf ) )
+   {
+      ERROR_MESSAGE( "dma_buf_export: %ld\n", PTR_ERR( pDmaBuf ) );
+      return PTR_ERR( pDmaBuf );
+   }
+
+   /*
+    * The file descriptor becomes installed not until the caller knows it.
+    */
+   arg.fd = get_unused_fd_flags( arg.flags );
+   if( arg.fd < 0 )
+   {
+      dma_buf_put( pDmaBuf );
+      return arg.fd;
+   }
+
+   if( copy_to_user( pArg, &arg, sizeof( arg ) ) != 0 )
+   {
+      put_unused_fd( arg.fd );
+      dma_buf_put( pDmaBuf );
+      return -EFAULT;
+   }
+
+   fd_install( arg.fd, pDmaBuf->file );
+   return 0;
+}
+
 /*-----------------------------------------------------------------------------
  */
 static long onIoctl( struct file* pFile, unsigned int cmd, unsigned long arg )
@@ -137,6 +328,26 @@ static long onIoctl( struct file* pFile, unsigned int cmd, unsigned long arg )
       return 0;
    }
 
+   if( cmd == DMAFLIP_IOCTL_EXPORT )
+      return exportDmaBuf( (DMAFLIP_EXPORT_T __user *)arg );
+
+   if( cmd == DMAFLIP_IOCTL_SET_MAP_ATTR )
+   {
+      unsigned int mapAttr;
+      if( get_user( mapAttr, (unsigned int __user *)arg ) != 0 )
+         return -EFAULT;
+      if( mapAttr > DMAFLIP_MAP_UNCACHED )
+         return -EINVAL;
+      /*
+       * x86 with PAT maps RAM into user-space write-back only, regardless
+       * of the requested attribute.
+       */
+      if( IS_ENABLED( CONFIG_X86 ) && (mapAttr >= DMAFLIP_MAP_WRITECOMBINE) )
+         return -EOPNOTSUPP;
+      ((struct FILE_T*)pFile->private_data)->mapAttr = mapAttr;
+      return 0;
+   }
+
    return -ENOTTY;
 }
 
@@ -145,6 +356,11 @@ static long onIoctl( struct file* pFile, unsigned int cmd, unsigned long arg )
 static int onOpen(struct inode *inode, struct file *file)
 {
    DEBUG_MESSAGE( "\n" );
+   struct FILE_T* pFileData = kzalloc( sizeof( struct FILE_T ), GFP_KERNEL );
+   if( pFileData == NULL )
+      return -ENOMEM;
+   pFileData->mapAttr = DMAFLIP_MAP_DEFAULT;
+   file->private_data = pFileData;
    return 0;
 }
 
@@ -153,6 +369,7 @@ static int onOpen(struct inode *inode, struct file *file)
 static int onClose(struct inode *inode, struct file *file)
 {
    DEBUG_MESSAGE( "\n" );
+   kfree( file->private_data );
    return 0;
 }
 
@@ -12,6 +12,8 @@
 #ifndef _FLIP_DMA_CTL_H
 #define _FLIP_DMA_CTL_H
 
+#include <linux/types.h>
+#include <linux/ioctl.h>
 #ifndef __KERNEL__
  #include <sys/ioctl.h>
  #include <sys/mman.h>
@@ -29,5 +31,52 @@
 
 #define DMAFLIP_IOCTL_GET_SEQUENCE _IOR( 'S', 1, unsigned int )
 
+/*!
+ * @brief Argument of DMAFLIP_IOCTL_EXPORT.
+ */
+typedef struct
+{
+   /*! @brief Input: 0 or O_CLOEXEC for the new file descriptor. */
+   __u32 flags;
+   /*! @brief Output: file descriptor of the dma-buf. */
+   __s32 fd;
+} DMAFLIP_EXPORT_T;
+
+/*!
+ * @brief Exports the flip buffers (TOTAL_BUFFER_SIZE bytes) as dma-buf
+ *        file descriptor, which can be passed to other processes and
+ *        drivers and mapped by mmap() like the device file.
+ */
+#define DMAFLIP_IOCTL_EXPORT _IOWR( 'S', 2, DMAFLIP_EXPORT_T )
+
+/*!
+ * @brief Memory attributes of the following mmap() calls of the opened
+ *        file, @see DMAFLIP_IOCTL_SET_MAP_ATTR
+ */
+#define DMAFLIP_MAP_DEFAULT      0 /*!< @brief As chosen by the DMA API. */
+/*!
+ * @brief Cached, best for a consumer which reads the data repeatedly.
+ * Available on cache coherent platforms only, otherwise mmap() fails
+ * with EINVAL.
+ */
+#define DMAFLIP_MAP_CACHED       1
+#define DMAFLIP_MAP_WRITECOMBINE 2 /*!< @brief Best for sequential writing. */
+/*!
+ * @brief Each access goes to the memory. On ARM it is Normal non-cacheable
+ * memory like DMAFLIP_MAP_WRITECOMBINE, because device memory faults on
+ * the unaligned accesses of memcpy().
+ */
+#define DMAFLIP_MAP_UNCACHED     3
+
+/*!
+ * @brief Selects the memory attribute of the following mmap() calls of
+ *        the opened file, argument is a pointer to a unsigned int
+ *        containing a DMAFLIP_MAP_* value.
+ *
+ * On x86 DMAFLIP_MAP_WRITECOMBINE and DMAFLIP_MAP_UNCACHED fail with
+ * EOPNOTSUPP: PAT keeps user mappings of RAM write-back.
+ */
+#define DMAFLIP_IOCTL_SET_MAP_ATTR _IOW( 'S', 3, unsigned int )
+
 #endif /* ifndef _FLIP_DMA_CTL_H */
 /*================================== EOF ====================================*/
@@ -18,6 +18,8 @@
 #include <linux/uaccess.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
+#include <linux/atomic.h>
+#include <linux/slab.h>
 
 
 MODULE_LICENSE( "GPL" );
@@ -75,13 +77,53 @@ typedef struct
 {
    int               minor;
    atomic_t          openCount;
+   struct device*    pDev;
    struct mutex      oMutex;
    wait_queue_head_t readWaitQueue;
    wait_queue_head_t writeWaitQueue;
    int               index;
    char              buffer[16];
+   /*!
+    * @brief When true, onWrite() never blocks: a not yet read message
+    *        becomes overwritten by the newest one ("flight recorder").
+    * @see /sys/class/poll/poll[n]/overwrite
+    */
+   bool              overwrite;
+   /*!
+    * @brief Number of messages dropped in overwrite mode.
+    * @see /sys/class/poll/poll[n]/drops
+    */
+   atomic_t          drops;
+   /*!
+    * @brief Becomes incremented by each written message, so a reader
+    *        recognizes when its message has been replaced in overwrite mode.
+    */
+   unsigned int      sequence;
+   /*!
+    * @brief True when the last byte of the current message has been read
+    *        by at least one reader. A replaced message which has not been
+    *        delivered counts as dropped.
+    */
+   bool              delivered;
 } INSTANCE_T;
 
+/*!
+ * @brief Object-type of private-data for each opened file.
+ */
+typedef struct
+{
+   INSTANCE_T*  pInstance;
+   /*!
+    * @brief Sequence number of the message which is being read,
+    *        valid when the file offset is > 0.
+    */
+   unsigned int sequence;
+   /*!
+    * @brief Length of the message which is being read.
+    */
+   int          length;
+} SESSION_T;
+
 /*!
  * @brief Structure of global variables.
  *
@@ -108,12 +150,18 @@ static int onOpen( struct inode* pInode, struct file* pFile )
 {
    int instanceIndex = MINOR(pInode->i_rdev);
    INSTANCE_T* pInstance = &mg.instance[ instanceIndex ];
+   SESSION_T* pSession;
 
    DEBUG_MESSAGE( ": Minor-number: %d\n", instanceIndex );
    BUG_ON( pFile->private_data != NULL );
    BUG_ON( instanceIndex >= MAX_INSTANCES );
 
-   pFile->private_data = pInstance;
+   pSession = kzalloc( sizeof( SESSION_T ), GFP_KERNEL );
+   if( pSession == NULL )
+      return -ENOMEM;
+   pSession->pInstance = pInstance;
+
+   pFile->private_data = pSession;
 
    if( atomic_inc_and_test( &pInstance->openCount ) == 1 )
    {
@@ -131,6 +179,7 @@ static int onClose( struct inode *pInode, struct file* pFile )
 {
    DEBUG_MESSAGE( ": Minor-number: %d\n", MINOR(pInode->i_rdev) );
    BUG_ON( pFile->private_data == NULL );
+   kfree( pFile->private_data );
    atomic_dec( &mg.instance[ MINOR(pInode->i_rdev) ].openCount );
    DEBUG_MESSAGE( "   Open-counter: %d\n", 
                   atomic_read( &mg.instance[ MINOR(pInode->i_rdev) ].openCount ));
@@ -149,23 +198,53 @@ static ssize_t onRead( struct file* pFile,       /*!< @see include/linux/fs.h
 {
    ssize_t remaining;
    size_t  copyLen;
-   INSTANCE_T* pInstance = pFile->private_data;
+   SESSION_T* pSession = pFile->private_data;
+   INSTANCE_T* pInstance;
 
    DEBUG_MESSAGE( ": userCapacity = %ld, offset = %lld\n", (long int)userCapacity, *pOffset );
    DEBUG_ACCESSMODE( pFile );
 
-   BUG_ON( pInstance == NULL );
+   BUG_ON( pSession == NULL );
+   pInstance = pSession->pInstance;
    DEBUG_MESSAGE( "   Minor: %d\n", pInstance->minor );
    DEBUG_MESSAGE( "   Open-counter: %d\n",
                    atomic_read( &pInstance->openCount ));
 
-   if( (*pOffset > 0) && (pInstance->index == *pOffset))
+L_RETRY:
+   mutex_lock( &pInstance->oMutex );
+   if( *pOffset > 0 )
    {
-      pInstance->index = 0;
-      *pOffset = 0;
-      wake_up_interruptible( &pInstance->writeWaitQueue );
-      return 0;
+      if( pSession->sequence != pInstance->sequence )
+      {  /*
+          * The message has been replaced by a newer one in overwrite mode
+          * meanwhile. A completely read message ends regularly and the new
+          * one stays for the next read. A partially read one would become
+          * mixed with the new one, so the read fails; the rest of the
+          * message has been counted as drop by the writer.
+          */
+         remaining = (*pOffset < pSession->length)? -EIO : 0;
+         *pOffset = 0;
+         mutex_unlock( &pInstance->oMutex );
+         return remaining;
+      }
+      if( pInstance->index == *pOffset )
+      {
+         pInstance->index = 0;
+         *pOffset = 0;
+         mutex_unlock( &pInstance->oMutex );
+         wake_up_interruptible( &pInstance->writeWaitQueue );
+         return 0;
+      }
+      if( pInstance->index == 0 )
+      {  /*
+          * Message has been finished by a concurrent reader.
+          */
+         *pOffset = 0;
+         mutex_unlock( &pInstance->oMutex );
+         return 0;
+      }
    }
+   mutex_unlock( &pInstance->oMutex );
 
    if( pInstance->index == 0 ) /* No data to read present? */
    {
@@ -185,20 +264,85 @@ static ssize_t onRead( struct file* pFile,       /*!< @see include/linux/fs.h
          return -ERESTARTSYS;  /* Loop */
    }
 
-   copyLen = min( userCapacity, sizeof(pInstance->buffer) );
-   if( copyLen > pInstance->index )
-      copyLen = pInstance->index;
+   mutex_lock( &pInstance->oMutex );
+   if( *pOffset == 0 )
+   {
+      if( pInstance->index == 0 )
+      {  /*
+          * Taken by a concurrent reader before we got the mutex.
+          */
+         mutex_unlock( &pInstance->oMutex );
+         goto L_RETRY;
+      }
+      pSession->sequence = pInstance->sequence;
+      pSession->length   = pInstance->index;
+   }
+   else if( (pSession->sequence != pInstance->sequence) || (*pOffset >= pInstance->index) )
+   {  /*
+       * Changed while the mutex was released, handled at the top.
+       */
+      mutex_unlock( &pInstance->oMutex );
+      goto L_RETRY;
+   }
 
-   remaining = copy_to_user( pUserBuffer, &pInstance->buffer[*pOffset], copyLen - *pOffset );
-   if( remaining < 0 )
-      return -EFAULT; // Data not compleaty copied.
+   copyLen = min( userCapacity, (size_t)(pInstance->index - *pOffset) );
+   remaining = copy_to_user( pUserBuffer, &pInstance->buffer[*pOffset], copyLen );
+   if( (copyLen > 0) && (remaining == copyLen) )
+   {
+      mutex_unlock( &pInstance->oMutex );
+      return -EFAULT; // Nothing copied.
+   }
 
    copyLen  -= remaining;
    *pOffset += copyLen;
+   if( *pOffset == pInstance->index )
+      pInstance->delivered = true;
+   mutex_unlock( &pInstance->oMutex );
 
    return copyLen; /* Number of bytes successfully read. */
 }
 
+/*!----------------------------------------------------------------------------
+ * @brief Write function of the overwrite mode, it never blocks and never
+ *        returns -EAGAIN.
+ *
+ * A message which has not been read yet becomes dropped and replaced by
+ * the new one. Each dropped message increments the drop counter.
+ */
+static ssize_t writeOverwrite( INSTANCE_T* pInstance,
+                               const char __user* pUserBuffer,
+                               size_t len )
+{
+   char tmp[sizeof(pInstance->buffer)];
+
+   if( len > sizeof(tmp) )
+      len = sizeof(tmp);
+
+   /*
+    * Copying from user-space before taking the mutex, so a page-fault
+    * can't hold up the readers.
+    */
+   if( copy_from_user( tmp, pUserBuffer, len ) != 0 )
+      return -EFAULT;
+
+   mutex_lock( &pInstance->oMutex );
+   if( (pInstance->index > 0) && !pInstance->delivered )
+   {
+      atomic_inc( &pInstance->drops );
+      DEBUG_MESSAGE( ": message dropped, drops: %d\n",
+                     atomic_read( &pInstance->drops ) );
+   }
+   memcpy( pInstance->buffer, tmp, len );
+   pInstance->index = len;
+   pInstance->sequence++;
+   pInstance->delivered = false;
+   mutex_unlock( &pInstance->oMutex );
+
+   wake_up_interruptible( &pInstance->readWaitQueue );
+
+   return len;
+}
+
 /*!----------------------------------------------------------------------------
  * @brief Callback function becomes invoked by the function write() from the
  *        user-space.
@@ -208,7 +352,7 @@ static ssize_t onWrite( struct file *pFile,
                         size_t len,
                         loff_t* pOffset )
 {
-   INSTANCE_T* pInstance = pFile->private_data;
+   INSTANCE_T* pInstance = ((SESSION_T*)pFile->private_data)->pInstance;
 
    BUG_ON( pInstance == NULL );
    DEBUG_MESSAGE( ": len = %ld, offset = %lld\n", (long int)len, *pOffset );
@@ -217,6 +361,9 @@ static ssize_t onWrite( struct file *pFile,
    DEBUG_MESSAGE( "   Open-counter: %d\n",
                    atomic_read( &pInstance->openCount ));
 
+   if( READ_ONCE( pInstance->overwrite ) )
+      return writeOverwrite( pInstance, pUserBuffer, len );
+
    if( pInstance->index > 0 ) /* Buffer not completely read yet? */
    {
       if( pFile->f_flags & O_NONBLOCK )
@@ -231,8 +378,14 @@ static ssize_t onWrite( struct file *pFile,
        *       and "pInstance" is a pointer, that means his content can be
        *       modified by a concurrent task e.g.: by a read-call.
        */
-      if( wait_event_interruptible( pInstance->writeWaitQueue, (pInstance->index == 0) ) != 0)
+      if( wait_event_interruptible( pInstance->writeWaitQueue,
+                                    (pInstance->index == 0) || READ_ONCE( pInstance->overwrite ) ) != 0)
          return -ERESTARTSYS;  /* Loop */
+      /*
+       * Overwrite mode has been switched on meanwhile.
+       */
+      if( READ_ONCE( pInstance->overwrite ) )
+         return writeOverwrite( pInstance, pUserBuffer, len );
    }
 
    if( len > sizeof(pInstance->buffer) )
@@ -241,7 +394,11 @@ static ssize_t onWrite( struct file *pFile,
    if( copy_from_user( pInstance->buffer, pUserBuffer, len ) != 0 )
       return -EFAULT;
 
+   mutex_lock( &pInstance->oMutex );
    pInstance->index = len;
+   pInstance->sequence++;
+   pInstance->delivered = false;
+   mutex_unlock( &pInstance->oMutex );
 
    wake_up_interruptible( &pInstance->readWaitQueue );
 
@@ -254,12 +411,12 @@ static ssize_t onWrite( struct file *pFile,
  */
 static unsigned int onPoll( struct file* pFile, poll_table* pPollTable )
 {
-   INSTANCE_T* pInstance = pFile->private_data;
+   INSTANCE_T* pInstance = ((SESSION_T*)pFile->private_data)->pInstance;
    unsigned int ret = 0;
 
    BUG_ON( pInstance == NULL );
 
-   DEBUG_MESSAGE( ": Minor-number: %d\n", ((INSTANCE_T*)pFile->private_data)->minor );
+   DEBUG_MESSAGE( ": Minor-number: %d\n", pInstance->minor );
 
    mutex_lock( &pInstance->oMutex );
 
@@ -269,7 +426,7 @@ static unsigned int onPoll( struct file* pFile, poll_table* pPollTable )
    if( pInstance->index > 0 )
       ret |= (POLLIN | POLLRDNORM); /* ready to read */
 
-   if( pInstance->index == 0 )
+   if( (pInstance->index == 0) || pInstance->overwrite )
       ret |= (POLLOUT | POLLWRNORM); /* ready to write */
 
    mutex_unlock( &pInstance->oMutex );
@@ -290,6 +447,83 @@ static struct file_operations mg_fops =
 };
 /* Device file operations end ************************************************/
 
+/****************** Device attribut functions ********************************/
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/poll/poll[n]/overwrite
+ */
+static ssize_t overwrite_show( struct device* pDev,
+                               struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%d\n", pInstance->overwrite );
+}
+
+/*-----------------------------------------------------------------------------
+ * echo 1 > /sys/class/poll/poll[n]/overwrite
+ */
+static ssize_t overwrite_store( struct device* pDev,
+                                struct device_attribute* pAttr,
+                                const char* pBuf, size_t count )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+   bool overwrite;
+
+   if( kstrtobool( pBuf, &overwrite ) != 0 )
+      return -EINVAL;
+
+   mutex_lock( &pInstance->oMutex );
+   pInstance->overwrite = overwrite;
+   mutex_unlock( &pInstance->oMutex );
+
+   /*
+    * Writers which are blocked at the moment can continue now.
+    */
+   if( overwrite )
+      wake_up_interruptible( &pInstance->writeWaitQueue );
+
+   return count;
+}
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/poll/poll[n]/drops
+ * echo 0 > /sys/class/poll/poll[n]/drops resets the counter.
+ */
+static ssize_t drops_show( struct device* pDev,
+                           struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%d\n", atomic_read( &pInstance->drops ) );
+}
+
+/*-----------------------------------------------------------------------------
+ */
+static ssize_t drops_store( struct device* pDev,
+                            struct device_attribute* pAttr,
+                            const char* pBuf, size_t count )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   atomic_set( &pInstance->drops, 0 );
+   return count;
+}
+
+static DEVICE_ATTR( overwrite, 0644, overwrite_show, overwrite_store );
+static DEVICE_ATTR( drops, 0644, drops_show, drops_store );
+
+static struct attribute* poll_attrs[] =
+{
+   &dev_attr_overwrite.attr,
+   &dev_attr_drops.attr,
+   NULL
+};
+
+ATTRIBUTE_GROUPS( poll );
+
+/****************** End device attribut functions ****************************/
+
 /*!----------------------------------------------------------------------------
  * @brief Driver constructor
  */
@@ -337,26 +571,34 @@ static int __init driverInit( void )
    for( minor = 0; minor < MAX_INSTANCES; minor++ )
    {
       currentMinor = minor;
-      if( device_create( mg.pClass,
-                         NULL,
-                         mg.deviceNumber | minor,
-                         NULL,
-                         DEVICE_BASE_FILE_NAME "%d",
-                         minor )
-          == NULL )
-      {
-         ERROR_MESSAGE( "device_create: " DEVICE_BASE_FILE_NAME "%d\n", minor );
-         goto L_INSTANCE_REMOVE;
-      }
       mg.instance[minor].minor = minor;
       atomic_set( &mg.instance[minor].openCount, 0 );
       memset( &mg.instance[minor].buffer, 0, sizeof(mg.instance[minor].buffer) );
       mg.instance[minor].index = 0;
+      mg.instance[minor].overwrite = false;
+      atomic_set( &mg.instance[minor].drops, 0 );
 
       init_waitqueue_head( &mg.instance[minor].readWaitQueue );
       init_waitqueue_head( &mg.instance[minor].writeWaitQueue );
       mutex_init( &mg.instance[minor].oMutex );
 
+      /*
+       * The attributes are created together with the device, so they exist
+       * already when udev gets the uevent.
+       */
+      mg.instance[minor].pDev = device_create_with_groups( mg.pClass,
+                                                           NULL,
+                                                           mg.deviceNumber | minor,
+                                                           &mg.instance[minor],
+                                                           poll_groups,
+                                                           DEVICE_BASE_FILE_NAME "%d",
+                                                           minor );
+      if( IS_ERR_OR_NULL( mg.instance[minor].pDev ) )
+      {
+         ERROR_MESSAGE( "device_create_with_groups: " DEVICE_BASE_FILE_NAME "%d\n", minor );
+         goto L_INSTANCE_REMOVE;
+      }
+
       DEBUG_MESSAGE( ": Instance " DEVICE_BASE_FILE_NAME "%d created\n", minor );
    }
    currentMinor = MAX_INSTANCES;
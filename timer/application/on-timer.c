@@ -17,6 +17,13 @@
  *! @code
  * udevadm control --reload
  *! @endcode
+ *
+ * Without options the program shows the ticks of all instances interactively.
+ * With option -b it runs headless as benchmark and prints the result
+ * as JSON to stdout, e.g.:
+ *! @code
+ * on-timer -b -n 4 -p 100us -m hrtimer -d 10
+ *! @endcode
  */
 #include <stdio.h>
 #include <signal.h>
@@ -30,8 +37,14 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
 #include <findInstances.h>
 #include <terminalHelper.h>
+#include <timer_ctl.h>
 
 #ifndef ARRAY_SIZE
  #define ARRAY_SIZE( a ) (sizeof( a ) / sizeof( a[0] ))
@@ -49,12 +62,474 @@ typedef struct
 
 char g_textBuffer[64];
 
-int main( void )
+/*!
+ * @brief Growing array of latencies in nanoseconds.
+ */
+typedef struct
+{
+   uint64_t* pData;
+   size_t    size;
+   size_t    capacity;
+} LATENCIES_T;
+
+/*!
+ * @brief Per instance state of the benchmark.
+ */
+typedef struct
+{
+   char          fileName[16];
+   int           fd;
+   bool          started;
+   uint64_t      lastSequence;
+   uint64_t      received;
+   uint64_t      missed;
+   uint64_t      coalesced;
+   uint64_t      wakeups;
+   unsigned long dropsAtStart;
+   /*! @brief Mode before the benchmark, empty when it hasn't been changed. */
+   char          previousMode[16];
+} BENCH_OBJ_T;
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns CLOCK_MONOTONIC in nanoseconds, the same clock the driver
+ *        uses for its time stamps.
+ */
+static uint64_t getMonotonicNs( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Converts a period like "100us" into nanoseconds, same syntax like
+ *        the driver: without unit the number means milliseconds.
+ * @return Period in nanoseconds or 0 in the case of a syntax error.
+ */
+static uint64_t parsePeriod( const char* pText )
+{
+   char* pUnit;
+   unsigned long long value = strtoull( pText, &pUnit, 10 );
+
+   if( pUnit == pText )
+      return 0;
+   if( (*pUnit == '\0') || (strcmp( pUnit, "ms" ) == 0) )
+      return value * 1000000ULL;
+   if( strcmp( pUnit, "us" ) == 0 )
+      return value * 1000ULL;
+   if( strcmp( pUnit, "ns" ) == 0 )
+      return value;
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Writes a string into a sysfs attribute of the given instance.
+ */
+static int writeAttribute( int minor, const char* pName, const char* pValue )
+{
+   char path[64];
+   snprintf( path, sizeof( path ), "/sys/class/" BASE_NAME "/" BASE_NAME "%d/%s", minor, pName );
+   int fd = open( path, O_WRONLY );
+   if( fd < 0 )
+      return -1;
+   int ret = (write( fd, pValue, strlen( pValue ) ) < 0)? -1 : 0;
+   close( fd );
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Reads a unsigned number from a sysfs attribute of the given
+ *        instance, returns 0 if the attribute isn't readable.
+ */
+static unsigned long readAttribute( int minor, const char* pName )
+{
+   char path[64];
+   unsigned long value = 0;
+   snprintf( path, sizeof( path ), "/sys/class/" BASE_NAME "/" BASE_NAME "%d/%s", minor, pName );
+   FILE* pFile = fopen( path, "r" );
+   if( pFile == NULL )
+      return 0;
+   if( fscanf( pFile, "%lu", &value ) != 1 )
+      value = 0;
+   fclose( pFile );
+   return value;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Reads the first word of a sysfs attribute of the given instance.
+ */
+static int readAttributeText( int minor, const char* pName, char* pValue, size_t size )
+{
+   char path[64];
+   char format[16];
+   snprintf( path, sizeof( path ), "/sys/class/" BASE_NAME "/" BASE_NAME "%d/%s", minor, pName );
+   snprintf( format, sizeof( format ), "%%%zus", size - 1 );
+   FILE* pFile = fopen( path, "r" );
+   if( pFile == NULL )
+      return -1;
+   int ret = (fscanf( pFile, format, pValue ) == 1)? 0 : -1;
+   fclose( pFile );
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static int addLatency( LATENCIES_T* pLat, uint64_t latency )
+{
+   if( pLat->size == pLat->capacity )
+   {
+      size_t capacity = (pLat->capacity == 0)? 4096 : pLat->capacity * 2;
+      uint64_t* pData = realloc( pLat->pData, capacity * sizeof( uint64_t ) );
+      if( pData == NULL )
+         return -1;
+      pLat->pData = pData;
+      pLat->capacity = capacity;
+   }
+   pLat->pData[pLat->size++] = latency;
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static int compareU64( const void* pA, const void* pB )
+{
+   uint64_t a = *(const uint64_t*)pA;
+   uint64_t b = *(const uint64_t*)pB;
+   return (a > b) - (a < b);
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Prints the percentiles of the latencies as JSON object.
+ */
+static void printLatencies( const char* pName, LATENCIES_T* pLat, bool last )
+{
+   printf( "  \"%s\": ", pName );
+   if( pLat->size == 0 )
+   {
+      printf( "null%s\n", last? "" : "," );
+      return;
+   }
+   qsort( pLat->pData, pLat->size, sizeof( uint64_t ), compareU64 );
+   #define _PERCENTILE( p ) pLat->pData[(size_t)((p) * (pLat->size - 1))]
+   printf( "{ \"samples\": %zu, \"min\": %llu, \"p50\": %llu, \"p90\": %llu, "
+           "\"p99\": %llu, \"p999\": %llu, \"max\": %llu }%s\n",
+           pLat->size,
+           (unsigned long long)pLat->pData[0],
+           (unsigned long long)_PERCENTILE( 0.5 ),
+           (unsigned long long)_PERCENTILE( 0.9 ),
+           (unsigned long long)_PERCENTILE( 0.99 ),
+           (unsigned long long)_PERCENTILE( 0.999 ),
+           (unsigned long long)pLat->pData[pLat->size - 1],
+           last? "" : "," );
+   #undef _PERCENTILE
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Drains the sample records of the instance and accounts them.
+ * @param now Time of the wakeup.
+ */
+static int benchmarkRead( BENCH_OBJ_T* pObj, uint64_t now,
+                          LATENCIES_T* pCallbackLat, LATENCIES_T* pWakeupLat )
+{
+   static TIMER_SAMPLE_T samples[256];
+   uint64_t total = 0;
+   uint64_t newestDeadline = 0;
+   size_t n;
+
+   do
+   {
+      ssize_t readBytes = read( pObj->fd, samples, sizeof( samples ) );
+      if( readBytes < 0 )
+      {
+         if( errno == EAGAIN )
+            break;
+         fprintf( stderr, "ERROR: unable to read from \"%s\": %s\n",
+                          pObj->fileName, strerror( errno ) );
+         return -1;
+      }
+      n = readBytes / sizeof( TIMER_SAMPLE_T );
+      if( n == 0 )
+         break;
+
+      for( size_t i = 0; i < n; i++ )
+      {
+         if( pObj->started && (samples[i].sequence > pObj->lastSequence + 1) )
+            pObj->missed += samples[i].sequence - pObj->lastSequence - 1;
+         pObj->started = true;
+         pObj->lastSequence = samples[i].sequence;
+         pObj->received++;
+         uint64_t latency = (samples[i].timestamp > samples[i].deadline)?
+                            (samples[i].timestamp - samples[i].deadline) : 0;
+         if( addLatency( pCallbackLat, latency ) != 0 )
+            return -1;
+      }
+
+      total += n;
+      newestDeadline = samples[n - 1].deadline;
+   }
+   while( n == ARRAY_SIZE( samples ) );
+
+   if( total == 0 )
+      return 0;
+
+   /*
+    * All ticks except the newest one of a wakeup have been coalesced,
+    * the latency of the wakeup is measured to the newest deadline.
+    */
+   pObj->wakeups++;
+   pObj->coalesced += total - 1;
+   return addLatency( pWakeupLat, (now > newestDeadline)? (now - newestDeadline) : 0 );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Headless benchmark: runs the given number of instances with the
+ *        given period for the given time and prints the result as JSON.
+ */
+static int runBenchmark( int numOfInstances, int requested, const char* pPeriod,
+                         const char* pMode, unsigned int duration )
+{
+   uint64_t period = parsePeriod( pPeriod );
+   if( period == 0 )
+   {
+      fprintf( stderr, "ERROR: Invalid period: \"%s\"\n", pPeriod );
+      return EXIT_FAILURE;
+   }
+   if( (requested <= 0) || (requested > numOfInstances) )
+      requested = numOfInstances;
+
+   BENCH_OBJ_T* pObjs = calloc( requested, sizeof( BENCH_OBJ_T ) );
+   struct pollfd* pFds = calloc( requested, sizeof( struct pollfd ) );
+   LATENCIES_T callbackLat = { NULL, 0, 0 };
+   LATENCIES_T wakeupLat = { NULL, 0, 0 };
+   int ret = EXIT_FAILURE;
+   int opened = 0;
+
+   if( (pObjs == NULL) || (pFds == NULL) )
+   {
+      fprintf( stderr, "ERROR: Unable to allocate memory for %d instances!\n", requested );
+      goto L_END;
+   }
+
+   for( ; opened < requested; opened++ )
+   {
+      BENCH_OBJ_T* pObj = &pObjs[opened];
+      snprintf( pObj->fileName, ARRAY_SIZE( pObj->fileName ), "/dev/" BASE_NAME "%d", opened );
+      pObj->fd = open( pObj->fileName, O_RDWR | O_NONBLOCK );
+      if( pObj->fd < 0 )
+      {
+         fprintf( stderr, "ERROR: Unable to open device: \"%s\": %s\n",
+                          pObj->fileName, strerror( errno ) );
+         goto L_CLOSE;
+      }
+      unsigned int format = TIMER_FORMAT_SAMPLES;
+      if( ioctl( pObj->fd, TIMER_IOCTL_SET_FORMAT, &format ) != 0 )
+      {
+         close( pObj->fd );
+         fprintf( stderr, "ERROR: Sample format not supported by \"%s\": %s\n",
+                          pObj->fileName, strerror( errno ) );
+         goto L_CLOSE;
+      }
+      if( pMode != NULL )
+      {
+         /*
+          * The mode is global for all users of the instance, so it
+          * becomes restored at the end.
+          */
+         if( readAttributeText( opened, "mode", pObj->previousMode,
+                                sizeof( pObj->previousMode ) ) != 0 )
+         {
+            close( pObj->fd );
+            fprintf( stderr, "ERROR: Unable to read mode of \"%s\": %s\n",
+                             pObj->fileName, strerror( errno ) );
+            goto L_CLOSE;
+         }
+         if( writeAttribute( opened, "mode", pMode ) != 0 )
+         {
+            close( pObj->fd );
+            fprintf( stderr, "ERROR: Unable to set mode \"%s\" of \"%s\": %s\n",
+                             pMode, pObj->fileName, strerror( errno ) );
+            goto L_CLOSE;
+         }
+      }
+      pObj->dropsAtStart = readAttribute( opened, "sample_drops" );
+      pFds[opened].fd = pObj->fd;
+      pFds[opened].events = POLLIN;
+   }
+
+   /*
+    * Start all instances as close as possible one after another,
+    * the samples from before the start become discarded below.
+    */
+   for( int i = 0; i < requested; i++ )
+   {
+      if( write( pObjs[i].fd, pPeriod, strlen( pPeriod ) ) < 0 )
+      {
+         fprintf( stderr, "ERROR: Unable to set period of \"%s\": %s\n",
+                          pObjs[i].fileName, strerror( errno ) );
+         goto L_STOP;
+      }
+   }
+
+   const uint64_t start = getMonotonicNs();
+   const uint64_t end = start + (uint64_t)duration * 1000000000ULL;
+   uint64_t now = start;
+   for( int i = 0; i < requested; i++ )
+   {
+      if( benchmarkRead( &pObjs[i], now, &callbackLat, &wakeupLat ) != 0 )
+         goto L_STOP;
+   }
+   for( int i = 0; i < requested; i++ )
+   {
+      pObjs[i].received = pObjs[i].missed = pObjs[i].coalesced = pObjs[i].wakeups = 0;
+      pObjs[i].started = false;
+      pObjs[i].dropsAtStart = readAttribute( i, "sample_drops" );
+   }
+   callbackLat.size = wakeupLat.size = 0;
+
+   while( now < end )
+   {
+      int timeout = (int)((end - now + 999999) / 1000000);
+      int state = poll( pFds, requested, timeout );
+      if( state < 0 )
+      {
+         if( errno == EINTR )
+            continue;
+         fprintf( stderr, "ERROR: poll: %s\n", strerror( errno ) );
+         goto L_STOP;
+      }
+      now = getMonotonicNs();
+      for( int i = 0; (state > 0) && (i < requested); i++ )
+      {
+         if( (pFds[i].revents & POLLIN) == 0 )
+            continue;
+         if( benchmarkRead( &pObjs[i], now, &callbackLat, &wakeupLat ) != 0 )
+            goto L_STOP;
+      }
+   }
+   const double elapsed = (getMonotonicNs() - start) / 1e9;
+
+   uint64_t received = 0, missed = 0, coalesced = 0, wakeups = 0, drops = 0;
+   for( int i = 0; i < requested; i++ )
+   {
+      received  += pObjs[i].received;
+      coalesced += pObjs[i].coalesced;
+      wakeups   += pObjs[i].wakeups;
+      /*
+       * A sample dropped by the ring of the driver leaves a gap in the
+       * sequence as well, so it is reported in sample_drops only.
+       */
+      const uint64_t instanceDrops = readAttribute( i, "sample_drops" ) - pObjs[i].dropsAtStart;
+      drops     += instanceDrops;
+      missed    += (pObjs[i].missed > instanceDrops)? (pObjs[i].missed - instanceDrops) : 0;
+   }
+
+   printf( "{\n"
+           "  \"instances\": %d,\n"
+           "  \"period_ns\": %llu,\n"
+           "  \"mode\": \"%s\",\n"
+           "  \"duration_s\": %.3f,\n"
+           "  \"expected_ticks\": %llu,\n"
+           "  \"received_ticks\": %llu,\n"
+           "  \"tick_rate_hz\": %.1f,\n"
+           "  \"missed_periods\": %llu,\n"
+           "  \"coalesced_ticks\": %llu,\n"
+           "  \"sample_drops\": %llu,\n"
+           "  \"wakeups\": %llu,\n",
+           requested,
+           (unsigned long long)period,
+           (pMode != NULL)? pMode : "default",
+           elapsed,
+           (unsigned long long)(elapsed * 1e9 / period) * requested,
+           (unsigned long long)received,
+           received / elapsed,
+           (unsigned long long)missed,
+           (unsigned long long)coalesced,
+           (unsigned long long)drops,
+           (unsigned long long)wakeups );
+   printLatencies( "callback_latency_ns", &callbackLat, false );
+   printLatencies( "wakeup_latency_ns", &wakeupLat, true );
+   printf( "}\n" );
+   ret = EXIT_SUCCESS;
+
+L_STOP:
+   for( int i = 0; i < opened; i++ )
+   {
+      if( write( pObjs[i].fd, "0", 1 ) < 0 )
+         fprintf( stderr, "ERROR: Unable to stop \"%s\"\n", pObjs[i].fileName );
+   }
+L_CLOSE:
+   for( int i = 0; i < opened; i++ )
+   {
+      if( (pObjs[i].previousMode[0] != '\0') &&
+          (writeAttribute( i, "mode", pObjs[i].previousMode ) != 0) )
+         fprintf( stderr, "ERROR: Unable to restore mode \"%s\" of \"%s\"\n",
+                          pObjs[i].previousMode, pObjs[i].fileName );
+      close( pObjs[i].fd );
+   }
+L_END:
+   free( callbackLat.pData );
+   free( wakeupLat.pData );
+   free( pFds );
+   free( pObjs );
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ */
+static void printHelp( const char* pProgramName )
+{
+   printf( "Usage: %s [options]\n"
+           "Without options the ticks of all instances become shown interactively.\n"
+           "Options:\n"
+           "  -b          Headless benchmark, prints the result as JSON.\n"
+           "  -n <count>  Number of instances for the benchmark, default: all.\n"
+           "  -p <period> Period, units: ms, us, ns, default: 1ms.\n"
+           "  -d <sec>    Duration of the benchmark in seconds, default: 10.\n"
+           "  -m <mode>   Timer mode: jiffies or hrtimer, default: unchanged.\n"
+           "              The previous mode becomes restored at the end.\n"
+           "  -h          This help.\n", pProgramName );
+}
+
+int main( int argc, char** argv )
 {
    ssize_t readBytes;
+   bool benchmark = false;
+   int requested = 0;
+   const char* pPeriod = "1ms";
+   const char* pMode = NULL;
+   unsigned int duration = 10;
+   int opt;
+
+   while( (opt = getopt( argc, argv, "bn:p:d:m:h" )) != -1 )
+   {
+      switch( opt )
+      {
+         case 'b': benchmark = true; break;
+         case 'n': requested = atoi( optarg ); break;
+         case 'p': pPeriod = optarg; break;
+         case 'd': duration = (unsigned int)atoi( optarg ); break;
+         case 'm': pMode = optarg; break;
+         case 'h': printHelp( argv[0] ); return EXIT_SUCCESS;
+         default:  printHelp( argv[0] ); return EXIT_FAILURE;
+      }
+   }
+
+   if( benchmark )
+   {
+      const int numOfInstances = getNumberOfFoundDriverInstances( BASE_NAME );
+      if( numOfInstances <= 0 )
+      {
+         fprintf( stderr, "ERROR: No driver-instance of " BASE_NAME " found!\n" );
+         return EXIT_FAILURE;
+      }
+      return runBenchmark( numOfInstances, requested, pPeriod, pMode, duration );
+   }
+
    printf( _ESC_XY( "1", "1" ) ESC_CLR_SCR  "Test of Linux-kernel-driver \"" BASE_NAME "\"\n"
    "Open a further console and send a message to /dev/" BASE_NAME "0\n"
    "E.g.: \"echo 1000 > /dev/" BASE_NAME "0\" sets a period of 1000 ms\n"
+   "      \"echo 100us > /dev/" BASE_NAME "0\" sets a period of 100 us (units: ms, us, ns)\n"
+   "      \"echo hrtimer > /sys/class/" BASE_NAME "/" BASE_NAME "0/mode\" selects the high resolution timer\n"
    "      \"echo 0 > /dev/" BASE_NAME "0\" suspends this timer- instance.\n" );
 
    const int numOfInstances = getNumberOfFoundDriverInstances( BASE_NAME );
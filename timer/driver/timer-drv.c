@@ -15,10 +15,62 @@
 #include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/ctype.h>
 #include <linux/poll.h>
+#include <linux/atomic.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/seqlock.h>
+#include <linux/debugfs.h>
+#include <linux/idr.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/smp.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/rcupdate.h>
+#include <linux/srcu.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>
+
+#include <timer_ctl.h>
+#include <timer_sampler.h>
+#include <timer_job.h>
 
 MODULE_LICENSE( "GPL" );
 
+/*!
+ * @brief Maximum number of private timers per opened file.
+ * @see TIMER_IOCTL_CREATE
+ */
+static unsigned int maxPrivateTimers = 8192;
+module_param( maxPrivateTimers, uint, 0644 );
+MODULE_PARM_DESC( maxPrivateTimers, "Maximum number of private timers per opened file" );
+
+/*!
+ * @brief Minimum period in nanoseconds of the instances and the private
+ *        timers, limits the load of the timer softirq which any user
+ *        who can open /dev/timer[n] can cause.
+ */
+static unsigned int minPeriod = 10 * NSEC_PER_USEC;
+module_param( minPeriod, uint, 0644 );
+MODULE_PARM_DESC( minPeriod, "Minimum period in nanoseconds" );
+
+/*!
+ * @brief Number of sample records per instance, becomes rounded up to
+ *        a power of two. 0 disables the format TIMER_FORMAT_SAMPLES.
+ */
+static unsigned int sampleRingSize = 1024;
+module_param( sampleRingSize, uint, 0444 );
+MODULE_PARM_DESC( sampleRingSize, "Number of sample records per instance, 0 disables sampling" );
+
+#define MAX_SAMPLE_RING_SIZE (1 << 20)
+
 
 #define CONFIG_DEBUG_SKELETON
 #define DEVICE_BASE_FILE_NAME KBUILD_MODNAME
@@ -46,28 +98,298 @@ MODULE_LICENSE( "GPL" );
 
 /* End of message helper macros for "dmesg" ++++++++***************************/
 
+/*!
+ * @brief Timer engine of a instance.
+ * @see /sys/class/timer/timer[n]/mode
+ */
+typedef enum
+{
+   /*! @brief Jiffies based timer_list, resolution 1..10 ms depending on HZ */
+   TIMER_MODE_JIFFIES = 0,
+   /*! @brief High resolution timer */
+   TIMER_MODE_HRTIMER = 1
+} TIMER_MODE_T;
+
+/*!
+ * @brief Context of the deferred job of a instance.
+ * @see /sys/class/timer/timer[n]/worker
+ * @see timer_job.h
+ */
+typedef enum
+{
+   /*! @brief No deferred job. */
+   WORKER_NONE      = 0,
+   /*! @brief Own kthread worker of the instance with SCHED_FIFO priority. */
+   WORKER_KTHREAD   = 1,
+   /*! @brief Unbound workqueue shared by all instances. */
+   WORKER_WORKQUEUE = 2
+} WORKER_T;
+
+/*!
+ * @brief Number of buckets of the latency histogram.
+ *
+ * Bucket 0 counts latencies of 0 ns, bucket n > 0 counts latencies
+ * from 2^(n-1) ns to 2^n - 1 ns. The last bucket collects all greater
+ * latencies.
+ */
+#define LATENCY_HISTOGRAM_SIZE 32
+
+/*!
+ * @brief Statistic of the difference between scheduled and actual expiry.
+ */
+typedef struct
+{
+   u64 samples;
+   u64 min;
+   u64 max;
+   u64 sum;
+   u32 histogram[LATENCY_HISTOGRAM_SIZE];
+} LATENCY_T;
+
+/*!
+ * @brief Lock-free single producer single consumer ring of sample records.
+ *
+ * The producer is the timer callback function, it writes head only.
+ * The consumer is read(), it writes tail only. Concurrent readers become
+ * serialized by readMutex, the producer never takes a lock.
+ */
+typedef struct
+{
+   TIMER_SAMPLE_T* pBuffer;
+   /*!
+    * @brief Number of records minus one, the number of records is a
+    *        power of two.
+    */
+   unsigned int    mask;
+   unsigned int    head;
+   unsigned int    tail;
+   /*!
+    * @brief Number of records lost because the ring was full.
+    * @see /sys/class/timer/timer[n]/sample_drops
+    */
+   atomic_t        drops;
+   struct mutex    readMutex;
+} SAMPLE_RING_T;
+
 typedef struct
 {
    unsigned int      minor;
+   struct device*    pDev;
+   TIMER_MODE_T      mode;
    struct timer_list timer;
-   unsigned int      period;
+   struct hrtimer    hrTimer;
+   /*!
+    * @brief Period in nanoseconds, 0 means suspended.
+    */
+   u64               period;
+   /*!
+    * @brief CLOCK_MONOTONIC time in nanoseconds when the timer has been
+    *        started, all deadlines are multiples of period from here.
+    */
+   u64               epoch;
+   /*!
+    * @brief Absolute CLOCK_MONOTONIC time of the next expiry in nanoseconds.
+    */
+   u64               deadline;
+   /*!
+    * @brief Group of phase aligned instances, 0 means no group.
+    * @see /sys/class/timer/timer[n]/group
+    */
+   unsigned int      group;
+   /*!
+    * @brief Slack in nanoseconds the expiry may be delayed, so the kernel
+    *        can coalesce it with other wakeups. Effective in hrtimer mode.
+    * @see /sys/class/timer/timer[n]/slack
+    */
+   u64               slack;
+   /*!
+    * @brief CPU on which the timer callback function runs, -1 means any
+    *        CPU chosen by the kernel.
+    * @see /sys/class/timer/timer[n]/cpu
+    */
+   int               cpu;
+   /*!
+    * @brief Serializes the configuration (period and mode) of the instance.
+    * @note The timer callback functions never take this mutex.
+    */
    struct mutex      oMutex;
    wait_queue_head_t readWaitQueue;
-   unsigned int    count;
+   /*!
+    * @brief Number of ticks since the last read.
+    *
+    * Incremented by the timer callback function and fetched and reset
+    * by the readers via atomic_xchg(), so no lock is necessary.
+    */
+   atomic_t          count;
+   /*!
+    * @brief Number of missed expirations since the last read.
+    */
+   atomic_t          overruns;
+   /*!
+    * @brief CLOCK_MONOTONIC time of the last expiry in nanoseconds.
+    */
+   atomic64_t        lastExpiry;
+   /*!
+    * @brief Page which can be mapped read-only into the user-space.
+    * @see TIMER_PAGE_T
+    */
+   TIMER_PAGE_T*     pPage;
+   /*!
+    * @brief Expiry latency, written by the timer callback function only.
+    * @see /sys/class/timer/timer[n]/latency
+    * @see /sys/class/timer/timer[n]/histogram
+    */
+   LATENCY_T         latency;
+   seqcount_t        latencySeq;
+   /*!
+    * @brief Set by the debugfs file "reset", the timer callback function
+    *        resets the latency statistic on its next tick.
+    */
+   atomic_t          latencyResetRequest;
+   struct dentry*    pDebugDir;
+   /*!
+    * @brief Sample records for the format TIMER_FORMAT_SAMPLES.
+    */
+   SAMPLE_RING_T     samples;
+   /*!
+    * @brief Context of the deferred job, becomes changed only while the
+    *        timer is stopped.
+    */
+   WORKER_T               worker;
+   struct kthread_worker* pKthreadWorker;
+   struct kthread_work    kthreadWork;
+   struct work_struct     work;
+   /*!
+    * @brief Deadline of the tick which has been queued the job.
+    */
+   atomic64_t        jobDeadline;
+   /*!
+    * @brief Statistic of the deferred job.
+    * @see /sys/class/timer/timer[n]/jobs
+    */
+   atomic_t          jobRuns;
+   atomic_t          jobMisses;
+   atomic64_t        jobMaxDelay;
 } INSTANCE_T;
 
+/*!
+ * @brief Object-type of private-data for each opened file.
+ */
+typedef struct
+{
+   INSTANCE_T*  pInstance;
+   /*!
+    * @brief Read format TIMER_FORMAT_TEXT, TIMER_FORMAT_BINARY,
+    *        TIMER_FORMAT_ALL or TIMER_FORMAT_SAMPLES
+    * @see TIMER_IOCTL_SET_FORMAT
+    */
+   unsigned int format;
+   /*!
+    * @brief Serializes creating, changing and deleting of private timers.
+    */
+   struct mutex      privateMutex;
+   /*!
+    * @brief Private timers of this file, indexed by their id.
+    */
+   struct idr        privateTimers;
+   unsigned int      numPrivateTimers;
+   /*!
+    * @brief Protects readyList and the expirations of the private timers,
+    *        becomes taken by their callback function.
+    */
+   spinlock_t        readyLock;
+   /*!
+    * @brief List of the private timers with expirations > 0.
+    */
+   struct list_head  readyList;
+   wait_queue_head_t readyWaitQueue;
+} SESSION_T;
+
+/*!
+ * @brief Private timer of a opened file.
+ * @see TIMER_IOCTL_CREATE
+ */
+typedef struct
+{
+   struct hrtimer    hrTimer;
+   SESSION_T*        pSession;
+   u32               id;
+   /*!
+    * @brief Period in nanoseconds, 0 means suspended.
+    */
+   u64               period;
+   /*!
+    * @brief Expirations since the last report, protected by readyLock.
+    */
+   u64               expirations;
+   struct list_head  readyEntry;
+} PRIVATE_TIMER_T;
+
 #define MAX_INSTANCES 4
 
+/*!
+ * @brief Number of groups, enough to put each instance in a own group.
+ */
+#define MAX_GROUPS MAX_INSTANCES
+
+/*!
+ * @brief Group of instances sharing a common epoch, so the expiries of
+ *        its members line up on common multiples of their periods.
+ */
+typedef struct
+{
+   /*!
+    * @brief Number of instances belonging to this group.
+    */
+   unsigned int members;
+   /*!
+    * @brief CLOCK_MONOTONIC time in nanoseconds, set by the first started
+    *        member, 0 means not set yet.
+    */
+   u64          epoch;
+} GROUP_T;
+
 typedef struct
 {
    dev_t                   deviceNumber;
    struct cdev*            pObject;
    struct class*           pClass;
+   struct dentry*          pDebugDir;
    INSTANCE_T              instance[MAX_INSTANCES];
+   /*!
+    * @brief Becomes woken up by the expiry of any instance.
+    * @see TIMER_FORMAT_ALL
+    */
+   wait_queue_head_t       anyWaitQueue;
+   /*!
+    * @brief Protects the groups, becomes taken within oMutex of a instance.
+    */
+   struct mutex            groupMutex;
+   GROUP_T                 group[MAX_GROUPS];
+   /*!
+    * @brief Registered sample source or NULL, becomes dereferenced by
+    *        the timer callback functions under RCU.
+    */
+   TIMER_SAMPLER_T __rcu*  pSampler;
+   /*!
+    * @brief Registered job or NULL, becomes dereferenced by the workers
+    *        under mg_jobSrcu, because the job may sleep.
+    */
+   TIMER_JOB_T __rcu*      pJob;
+   /*!
+    * @brief Serializes the registration of sample source and job.
+    */
+   struct mutex            pluginMutex;
+   /*!
+    * @brief Unbound workqueue for instances in worker mode WORKER_WORKQUEUE.
+    */
+   struct workqueue_struct* pWorkqueue;
 } MODULE_GLOBAL_T;
 
 static MODULE_GLOBAL_T mg;
+DEFINE_STATIC_SRCU( mg_jobSrcu );
 
+static void privateTimersDestroy( SESSION_T* pSession );
 
 /*!----------------------------------------------------------------------------
  * @brief
@@ -75,14 +397,26 @@ static MODULE_GLOBAL_T mg;
 static int onOpen( struct inode* pInode, struct file* pFile )
 {
    unsigned int instanceIndex = MINOR(pInode->i_rdev);
-   INSTANCE_T* pObject = &mg.instance[ instanceIndex ];
-   pObject->minor = instanceIndex;
+   SESSION_T* pSession;
 
    DEBUG_MESSAGE( ": Minor-number: %d\n", instanceIndex );
    BUG_ON( pFile->private_data != NULL );
    BUG_ON( instanceIndex >= MAX_INSTANCES );
 
-   pFile->private_data = pObject;
+   pSession = kzalloc( sizeof( SESSION_T ), GFP_KERNEL );
+   if( pSession == NULL )
+      return -ENOMEM;
+
+   pSession->pInstance = &mg.instance[ instanceIndex ];
+   pSession->format = TIMER_FORMAT_TEXT;
+
+   mutex_init( &pSession->privateMutex );
+   idr_init( &pSession->privateTimers );
+   spin_lock_init( &pSession->readyLock );
+   INIT_LIST_HEAD( &pSession->readyList );
+   init_waitqueue_head( &pSession->readyWaitQueue );
+
+   pFile->private_data = pSession;
    return 0;
 }
 
@@ -92,211 +426,1859 @@ static int onOpen( struct inode* pInode, struct file* pFile )
 static int onClose( struct inode *pInode, struct file* pFile )
 {
    DEBUG_MESSAGE( ": Minor-number: %d\n", MINOR(pInode->i_rdev) );
+   privateTimersDestroy( pFile->private_data );
+   kfree( pFile->private_data );
+   pFile->private_data = NULL;
    return 0;
 }
 
 /*!----------------------------------------------------------------------------
- * @brief Callback function of the timer
+ * @brief Begin of a update of the user-space mapped page.
+ * @note The page has only one writer at the same time: either the timer
+ *       callback function or the configuration with stopped timer.
  */
-void onMyTimer( struct timer_list* pTimer )
+static inline void pageWriteBegin( TIMER_PAGE_T* pPage )
 {
-    INSTANCE_T* pInstance = from_timer( pInstance, pTimer, timer );
-    DEBUG_MESSAGE( ": Minor-number: %d\n", pInstance->minor );
-    /*
-     * Restart the timer
-     */
-    mod_timer( pTimer, jiffies + msecs_to_jiffies( pInstance->period ) );
+   WRITE_ONCE( pPage->sequence, pPage->sequence + 1 );
+   smp_wmb();
+}
 
-    mutex_lock( &pInstance->oMutex );
-    pInstance->count++;
-    wake_up_interruptible( &pInstance->readWaitQueue );
-    mutex_unlock( &pInstance->oMutex );
+/*!----------------------------------------------------------------------------
+ * @brief End of a update of the user-space mapped page.
+ */
+static inline void pageWriteEnd( TIMER_PAGE_T* pPage )
+{
+   smp_wmb();
+   WRITE_ONCE( pPage->sequence, pPage->sequence + 1 );
 }
 
 /*!----------------------------------------------------------------------------
- * @brief
+ * @brief Resets the latency statistic.
+ * @note The caller has to make sure that no concurrent writer exists.
  */
-static unsigned int onPoll( struct file* pFile, poll_table* pPollTable )
+static void latencyReset( INSTANCE_T* pInstance )
 {
-   unsigned int ret = 0;
-   INSTANCE_T* pInstance = (INSTANCE_T*)pFile->private_data;
-   BUG_ON( pInstance == NULL );
-   DEBUG_MESSAGE( ": Minor-number: %d\n", ((INSTANCE_T*)pFile->private_data)->minor );
+   /*
+    * Writers of a seqcount_t must not be preempted, this function
+    * becomes invoked from process context as well.
+    */
+   preempt_disable();
+   write_seqcount_begin( &pInstance->latencySeq );
+   memset( &pInstance->latency, 0, sizeof( pInstance->latency ) );
+   pInstance->latency.min = U64_MAX;
+   write_seqcount_end( &pInstance->latencySeq );
+   preempt_enable();
+}
 
-   mutex_lock( &pInstance->oMutex );
-   poll_wait( pFile, &pInstance->readWaitQueue, pPollTable );
-   if( pInstance->count > 0 )
-      ret |= (POLLIN | POLLRDNORM);
-   mutex_unlock( &pInstance->oMutex );
+/*!----------------------------------------------------------------------------
+ * @brief Adds the difference between scheduled and actual expiry to the
+ *        latency statistic.
+ * @note Becomes invoked by the timer callback function only.
+ */
+static void latencyRecord( INSTANCE_T* pInstance, u64 latency )
+{
+   LATENCY_T* pLatency = &pInstance->latency;
+   unsigned int bucket;
 
-   return ret;
+   if( atomic_xchg( &pInstance->latencyResetRequest, 0 ) != 0 )
+      latencyReset( pInstance );
+
+   bucket = (latency == 0)? 0 : (ilog2( latency ) + 1);
+   if( bucket >= LATENCY_HISTOGRAM_SIZE )
+      bucket = LATENCY_HISTOGRAM_SIZE - 1;
+
+   write_seqcount_begin( &pInstance->latencySeq );
+   pLatency->samples++;
+   pLatency->sum += latency;
+   if( latency < pLatency->min )
+      pLatency->min = latency;
+   if( latency > pLatency->max )
+      pLatency->max = latency;
+   pLatency->histogram[bucket]++;
+   write_seqcount_end( &pInstance->latencySeq );
 }
 
 /*!----------------------------------------------------------------------------
- * @brief
+ * @brief Makes a consistent copy of the latency statistic.
  */
-static ssize_t onRead( struct file* pFile,   /*!< @see include/linux/fs.h   */
-                       char __user* pUserBuffer, /*!< buffer to fill with data */
-                       size_t userCapacity,      /*!< maximum size to copy     */
-                       loff_t* pOffset )         /*!< pointer to the already copied bytes */
+static void latencyRead( INSTANCE_T* pInstance, LATENCY_T* pCopy )
 {
-   char textBuffer[32];
-   ssize_t ret = 0;
-   ssize_t remaining = 0;
-   INSTANCE_T* pInstance = (INSTANCE_T*)pFile->private_data;
-   DEBUG_MESSAGE( ": Minor-number: %d\n", pInstance->minor );
+   unsigned int sequence;
+   do
+   {
+      sequence = read_seqcount_begin( &pInstance->latencySeq );
+      *pCopy = pInstance->latency;
+   }
+   while( read_seqcount_retry( &pInstance->latencySeq, sequence ) );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Advances the absolute deadline of the instance behind the given
+ *        time.
+ *
+ * The deadlines are multiples of the period counted from the epoch, so
+ * the latency of the callback functions doesn't accumulate.
+ * @return Number of expirations since the previous tick, values greater
+ *         than one mean missed periods (overruns).
+ */
+static unsigned int advanceDeadline( INSTANCE_T* pInstance, u64 now )
+{
+   u64 expirations = 1;
 
+   pInstance->deadline += pInstance->period;
+   if( now >= pInstance->deadline )
+   {
+      u64 missed = div64_u64( now - pInstance->deadline, pInstance->period ) + 1;
+      expirations += missed;
+      pInstance->deadline += missed * pInstance->period;
+   }
 
-   mutex_lock( &pInstance->oMutex );
-   ret = snprintf( textBuffer,
-                   min( sizeof( textBuffer ),
-                        userCapacity),
-                   "%d", pInstance->count );
+   return min_t( u64, expirations, UINT_MAX );
+}
 
-   pInstance->count = 0;
-   mutex_unlock( &pInstance->oMutex );
+/*!----------------------------------------------------------------------------
+ * @brief Registers the sample source for all timer instances.
+ * @see timer_sampler.h
+ */
+int timerRegisterSampler( TIMER_SAMPLER_T* pSampler )
+{
+   int ret = 0;
 
-   remaining = copy_to_user( pUserBuffer, textBuffer, ret );
-   if( remaining < 0 )
-      return -EFAULT;
+   mutex_lock( &mg.pluginMutex );
+   if( rcu_access_pointer( mg.pSampler ) != NULL )
+      ret = -EBUSY;
+   else
+      rcu_assign_pointer( mg.pSampler, pSampler );
+   mutex_unlock( &mg.pluginMutex );
 
-   *pOffset = ret;
    return ret;
 }
+EXPORT_SYMBOL_GPL( timerRegisterSampler );
 
 /*!----------------------------------------------------------------------------
- * @brief
+ * @brief Unregisters the sample source and waits till it isn't in use
+ *        anymore.
+ * @see timer_sampler.h
  */
-static ssize_t onWrite( struct file *pFile,
-                        const char __user* pUserBuffer,
-                        size_t len,
-                        loff_t* pOffset )
+void timerUnregisterSampler( TIMER_SAMPLER_T* pSampler )
 {
-   size_t n;
-   char  tmp[256];
-   INSTANCE_T* pInstance;
-   long period;
-   int ret;
+   mutex_lock( &mg.pluginMutex );
+   if( rcu_access_pointer( mg.pSampler ) == pSampler )
+      RCU_INIT_POINTER( mg.pSampler, NULL );
+   mutex_unlock( &mg.pluginMutex );
+   synchronize_rcu();
+}
+EXPORT_SYMBOL_GPL( timerUnregisterSampler );
 
-   memset( tmp, 0, sizeof(tmp) );
-   n = min( ARRAY_SIZE( tmp )-1, len );
+/*!----------------------------------------------------------------------------
+ * @brief Registers the job for all timer instances.
+ * @see timer_job.h
+ */
+int timerRegisterJob( TIMER_JOB_T* pJob )
+{
+   int ret = 0;
 
-   pInstance = (INSTANCE_T*)pFile->private_data;
+   mutex_lock( &mg.pluginMutex );
+   if( rcu_access_pointer( mg.pJob ) != NULL )
+      ret = -EBUSY;
+   else
+      rcu_assign_pointer( mg.pJob, pJob );
+   mutex_unlock( &mg.pluginMutex );
 
-   DEBUG_MESSAGE( ": Minor-number: %d\n", pInstance->minor);
-   if( copy_from_user( tmp, pUserBuffer, n ) != 0 )
-   {
-      ERROR_MESSAGE( "copy_from_user\n" );
-      return -EFAULT;
-   }
+   return ret;
+}
+EXPORT_SYMBOL_GPL( timerRegisterJob );
 
-   ret = kstrtol( tmp, 10, &period );
-   if( ret < 0 )
-      return ret;
+/*!----------------------------------------------------------------------------
+ * @brief Unregisters the job and waits till it isn't running anymore.
+ * @see timer_job.h
+ */
+void timerUnregisterJob( TIMER_JOB_T* pJob )
+{
+   mutex_lock( &mg.pluginMutex );
+   if( rcu_access_pointer( mg.pJob ) == pJob )
+      RCU_INIT_POINTER( mg.pJob, NULL );
+   mutex_unlock( &mg.pluginMutex );
+   synchronize_srcu( &mg_jobSrcu );
+}
+EXPORT_SYMBOL_GPL( timerUnregisterJob );
 
-   mutex_lock( &pInstance->oMutex );
-   pInstance->count = 0;
-   mutex_unlock( &pInstance->oMutex );
+/*!----------------------------------------------------------------------------
+ * @brief Runs the registered job for the given instance.
+ * @note Runs in process context, a work item never runs concurrently
+ *       with itself, so the statistic needs no lock.
+ */
+static void runJob( INSTANCE_T* pInstance )
+{
+   TIMER_JOB_T* pJob;
+   u64 deadline = atomic64_read( &pInstance->jobDeadline );
+   u64 now = ktime_get_ns();
+   int index;
 
-   if( period == 0 )
-   {
-      DEBUG_MESSAGE( "timer%d suspended\n", pInstance->minor  );
-      pInstance->period = ~0;
-      mod_timer( &pInstance->timer, ~0 );
-   }
-   else
-   {
-      DEBUG_MESSAGE( "new period fot timer%d: %u\n", pInstance->minor, (unsigned int)period );
-      pInstance->period = period;
-      mod_timer( &pInstance->timer, jiffies + msecs_to_jiffies( pInstance->period ) );
-   }
+   if( (now > deadline) && ((now - deadline) > atomic64_read( &pInstance->jobMaxDelay )) )
+      atomic64_set( &pInstance->jobMaxDelay, now - deadline );
 
-   return n;
+   index = srcu_read_lock( &mg_jobSrcu );
+   pJob = srcu_dereference( mg.pJob, &mg_jobSrcu );
+   if( pJob != NULL )
+      pJob->run( pInstance->minor, deadline, pJob->pPrivate );
+   srcu_read_unlock( &mg_jobSrcu, index );
+
+   atomic_inc( &pInstance->jobRuns );
 }
 
+/*!----------------------------------------------------------------------------
+ * @brief Work function of the kthread worker of a instance.
+ */
+static void onKthreadWork( struct kthread_work* pWork )
+{
+   runJob( container_of( pWork, INSTANCE_T, kthreadWork ) );
+}
 
-static struct file_operations mg_fops =
+/*!----------------------------------------------------------------------------
+ * @brief Work function of the unbound workqueue.
+ */
+static void onWork( struct work_struct* pWork )
 {
-  .owner          = THIS_MODULE,
-  .open           = onOpen,
-  .release        = onClose,
-  .read           = onRead,
-  .write          = onWrite,
-  .poll           = onPoll
-};
+   runJob( container_of( pWork, INSTANCE_T, work ) );
+}
 
 /*!----------------------------------------------------------------------------
- * @brief Driver constructor
+ * @brief Queues the job of the instance for the tick with the given deadline.
+ *
+ * When the job of a previous tick is still pending, the tick becomes
+ * counted as missed, the pending job gets the newer deadline.
+ * @note Called by the timer callback function.
  */
-static int __init driverInit( void )
+static void queueJob( INSTANCE_T* pInstance, u64 deadline )
 {
-   DEBUG_MESSAGE("\n");
-   unsigned int minor, currentMinor;
+   bool queued;
 
+   atomic64_set( &pInstance->jobDeadline, deadline );
+   if( pInstance->worker == WORKER_KTHREAD )
+      queued = kthread_queue_work( pInstance->pKthreadWorker, &pInstance->kthreadWork );
+   else
+      queued = queue_work( mg.pWorkqueue, &pInstance->work );
 
-   if( alloc_chrdev_region( &mg.deviceNumber, 0, MAX_INSTANCES, DEVICE_BASE_FILE_NAME ) < 0 )
-   {
-      ERROR_MESSAGE( "alloc_chrdev_region\n" );
-      return -EIO;
-   }
+   if( !queued )
+      atomic_inc( &pInstance->jobMisses );
+}
 
-   mg.pObject = cdev_alloc();
-   if( mg.pObject == NULL )
+/*!----------------------------------------------------------------------------
+ * @brief Waits for a running job and releases the worker of the instance.
+ * @note The timer has to be stopped before and oMutex has to be held.
+ */
+static void workerRelease( INSTANCE_T* pInstance )
+{
+   switch( pInstance->worker )
    {
-      ERROR_MESSAGE( "cdev_alloc\n" );
-      goto L_DEVICE_NUMBER;
+      case WORKER_KTHREAD:
+      {
+         kthread_destroy_worker( pInstance->pKthreadWorker );
+         pInstance->pKthreadWorker = NULL;
+         break;
+      }
+      case WORKER_WORKQUEUE:
+      {
+         cancel_work_sync( &pInstance->work );
+         break;
+      }
+      default: break;
    }
+   pInstance->worker = WORKER_NONE;
+}
 
-   mg.pObject->owner = THIS_MODULE;
-   mg.pObject->ops = &mg_fops;
-   if( cdev_add( mg.pObject, mg.deviceNumber, MAX_INSTANCES ) )
+/*!----------------------------------------------------------------------------
+ * @brief Replaces the worker of the instance.
+ * @note The timer has to be stopped before and oMutex has to be held.
+ */
+static int workerSetup( INSTANCE_T* pInstance, WORKER_T worker )
+{
+   struct kthread_worker* pKthreadWorker;
+
+   workerRelease( pInstance );
+   if( worker == WORKER_KTHREAD )
    {
-      ERROR_MESSAGE( "cdev_add\n" );
-      goto L_REMOVE_DEV;
-   }
-  /*!
-   * Register of the driver-instances visible in /sys/class/DEVICE_BASE_FILE_NAME
-   */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
-   mg.pClass = class_create( DEVICE_BASE_FILE_NAME );
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+      pKthreadWorker = kthread_run_worker( 0, DEVICE_BASE_FILE_NAME "%u", pInstance->minor );
 #else
-   mg.pClass = class_create( THIS_MODULE, DEVICE_BASE_FILE_NAME );
+      pKthreadWorker = kthread_create_worker( 0, DEVICE_BASE_FILE_NAME "%u", pInstance->minor );
 #endif
-   if( IS_ERR( mg.pClass ) )
-   {
-      ERROR_MESSAGE( "class_create: No udev support\n" );
-      goto L_CLASS_REMOVE;
+      if( IS_ERR( pKthreadWorker ) )
+         return PTR_ERR( pKthreadWorker );
+      /*
+       * Keeps the job on schedule against ordinary tasks.
+       */
+      sched_set_fifo_low( pKthreadWorker->task );
+      pInstance->pKthreadWorker = pKthreadWorker;
    }
+   pInstance->worker = worker;
 
-   for( minor = 0; minor < MAX_INSTANCES; minor++ )
-   {
-      currentMinor = minor;
-      if( device_create( mg.pClass,
-                         NULL,
-                         mg.deviceNumber | minor,
-                         NULL,
-                         DEVICE_BASE_FILE_NAME "%d",
-                         minor )
-          == NULL )
-      {
-         ERROR_MESSAGE( "device_create: " DEVICE_BASE_FILE_NAME "%d\n", minor );
-         goto L_INSTANCE_REMOVE;
-      }
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Appends a sample record into the ring of the instance.
+ * @note Producer side of the ring, called by the timer callback function only.
+ */
+static void sampleRecord( INSTANCE_T* pInstance, u64 sequence, u64 deadline, u64 now )
+{
+   SAMPLE_RING_T* pRing = &pInstance->samples;
+   TIMER_SAMPLE_T* pSample;
+   TIMER_SAMPLER_T* pSampler;
+   unsigned int head;
 
-      mg.instance[minor].minor = minor;
-      mg.instance[minor].period = ~0;
+   if( pRing->pBuffer == NULL )
+      return;
 
-      init_waitqueue_head( &mg.instance[minor].readWaitQueue );
-      mutex_init( &mg.instance[minor].oMutex );
-      timer_setup( &mg.instance[minor].timer, onMyTimer, 0 );
-      mg.instance[minor].count = 0;
+   head = pRing->head;
+   /*
+    * The acquire pairs with the release of the consumer, so the record
+    * isn't overwritten before the consumer has copied it.
+    */
+   if( head - smp_load_acquire( &pRing->tail ) > pRing->mask )
+   {
+      atomic_inc( &pRing->drops );
+      return;
    }
 
+   pSample = &pRing->pBuffer[head & pRing->mask];
+   pSample->sequence  = sequence;
+   pSample->deadline  = deadline;
+   pSample->timestamp = now;
+
+   rcu_read_lock();
+   pSampler = rcu_dereference( mg.pSampler );
+   pSample->value = (pSampler != NULL)? pSampler->sample( pInstance->minor, pSampler->pPrivate ) : 0;
+   rcu_read_unlock();
+
+   /*
+    * Publishes the record to the consumer.
+    */
+   smp_store_release( &pRing->head, head + 1 );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns the number of sample records in the ring.
+ */
+static inline unsigned int sampleLevel( SAMPLE_RING_T* pRing )
+{
+   return smp_load_acquire( &pRing->head ) - READ_ONCE( pRing->tail );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Discards all sample records in the ring and resets the drops.
+ *
+ * The producer fills the ring regardless of a reader, so a stream starts
+ * with the records from before and drops ticks until they are drained.
+ * @note Consumer side of the ring.
+ */
+static int sampleReset( SAMPLE_RING_T* pRing )
+{
+   if( mutex_lock_interruptible( &pRing->readMutex ) != 0 )
+      return -ERESTARTSYS;
+
+   smp_store_release( &pRing->tail, smp_load_acquire( &pRing->head ) );
+   atomic_set( &pRing->drops, 0 );
+   mutex_unlock( &pRing->readMutex );
+
    return 0;
+}
 
-L_INSTANCE_REMOVE:
-   for( minor = 0; minor < currentMinor; minor++ )
-      device_destroy( mg.pClass, mg.deviceNumber | minor );
+/*!----------------------------------------------------------------------------
+ * @brief Common part of both timer callback functions, accounts the tick
+ *        and advances pInstance->deadline to the next expiry.
+ * @note Runs in softirq context, therefore it must not sleep.
+ */
+static void onTick( INSTANCE_T* pInstance )
+{
+    TIMER_PAGE_T* pPage = pInstance->pPage;
+    u64 now = ktime_get_ns();
+    u64 scheduled = pInstance->deadline;
+    unsigned int expirations = advanceDeadline( pInstance, now );
+
+    /*
+     * In jiffies mode the callback can come a fraction of a jiffy
+     * before the deadline, that counts as in time.
+     */
+    latencyRecord( pInstance, (now > scheduled)? (now - scheduled) : 0 );
+
+    pageWriteBegin( pPage );
+    WRITE_ONCE( pPage->ticks, pPage->ticks + expirations );
+    WRITE_ONCE( pPage->lastExpiry, now );
+    if( expirations > 1 )
+       WRITE_ONCE( pPage->overruns, pPage->overruns + expirations - 1 );
+    pageWriteEnd( pPage );
+
+    sampleRecord( pInstance, pPage->ticks, scheduled, now );
+
+    if( pInstance->worker != WORKER_NONE )
+       queueJob( pInstance, scheduled );
+
+    atomic64_set( &pInstance->lastExpiry, now );
+    if( expirations > 1 )
+       atomic_add( expirations - 1, &pInstance->overruns );
+    atomic_add( expirations, &pInstance->count );
+    /*
+     * wq_has_sleeper() contains the memory barrier which pairs with
+     * the barrier in poll_wait() respectively in wait_event().
+     */
+    if( wq_has_sleeper( &pInstance->readWaitQueue ) )
+       wake_up_interruptible( &pInstance->readWaitQueue );
+    if( wq_has_sleeper( &mg.anyWaitQueue ) )
+       wake_up_interruptible( &mg.anyWaitQueue );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Converts the absolute deadline in nanoseconds into a expiry-time
+ *        in jiffies.
+ */
+static unsigned long deadlineToJiffies( u64 deadline )
+{
+   u64 now = ktime_get_ns();
+
+   if( deadline <= now )
+      return jiffies;
+
+   return jiffies + DIV_ROUND_UP_ULL( deadline - now, TICK_NSEC );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Callback function of the timer
+ */
+void onMyTimer( struct timer_list* pTimer )
+{
+    INSTANCE_T* pInstance = from_timer( pInstance, pTimer, timer );
+
+    onTick( pInstance );
+    /*
+     * Restart the timer
+     */
+    mod_timer( pTimer, deadlineToJiffies( pInstance->deadline ) );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Callback function of the high resolution timer
+ * @note Runs in softirq context like the callback of the timer_list,
+ *       because the timer becomes started with HRTIMER_MODE_ABS_SOFT.
+ */
+static enum hrtimer_restart onMyHrTimer( struct hrtimer* pTimer )
+{
+    INSTANCE_T* pInstance = container_of( pTimer, INSTANCE_T, hrTimer );
+
+    onTick( pInstance );
+    hrtimer_set_expires_range_ns( pTimer, ns_to_ktime( pInstance->deadline ),
+                                  pInstance->slack );
+
+    return HRTIMER_RESTART;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns the epoch for a timer which becomes started now.
+ *
+ * A instance without group begins a new epoch at the current time.
+ * A group member gets the epoch of its group, which has been set by the
+ * first started member, so the deadlines of all members are multiples
+ * of their periods counted from the same point in time.
+ */
+static u64 getEpoch( INSTANCE_T* pInstance, u64 now )
+{
+   GROUP_T* pGroup;
+   u64 epoch;
+
+   if( pInstance->group == 0 )
+      return now;
+
+   pGroup = &mg.group[pInstance->group - 1];
+   mutex_lock( &mg.groupMutex );
+   if( pGroup->epoch == 0 )
+      pGroup->epoch = now;
+   epoch = pGroup->epoch;
+   mutex_unlock( &mg.groupMutex );
+
+   return epoch;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Starts the high resolution timer pinned on the executing CPU.
+ * @note Runs on the target CPU by smp_call_function_single().
+ */
+static void startPinnedHrTimer( void* pData )
+{
+   INSTANCE_T* pInstance = pData;
+
+   hrtimer_start_range_ns( &pInstance->hrTimer, ns_to_ktime( pInstance->deadline ),
+                           pInstance->slack, HRTIMER_MODE_ABS_PINNED_SOFT );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Arms the timer on the CPU given by pInstance->cpu.
+ *
+ * A pinned timer_list becomes queued by add_timer_on() and keeps its CPU
+ * when it becomes restarted by mod_timer() in its callback function,
+ * because of the flag TIMER_PINNED. A pinned hrtimer becomes started on
+ * the target CPU itself, the restart by its callback function keeps the CPU.
+ * If the CPU is gone offline in the meantime, the timer runs unpinned.
+ */
+static void armTimer( INSTANCE_T* pInstance )
+{
+   int cpu;
+
+   cpus_read_lock();
+   cpu = pInstance->cpu;
+   if( (cpu >= 0) && !cpu_online( cpu ) )
+      cpu = -1;
+
+   if( pInstance->mode == TIMER_MODE_HRTIMER )
+   {
+      if( cpu >= 0 )
+         smp_call_function_single( cpu, startPinnedHrTimer, pInstance, 1 );
+      else
+         hrtimer_start_range_ns( &pInstance->hrTimer, ns_to_ktime( pInstance->deadline ),
+                                 pInstance->slack, HRTIMER_MODE_ABS_SOFT );
+   }
+   else if( cpu >= 0 )
+   {
+      /*
+       * The timer is stopped, so its flags can be changed here.
+       */
+      timer_setup( &pInstance->timer, onMyTimer, TIMER_PINNED );
+      pInstance->timer.expires = deadlineToJiffies( pInstance->deadline );
+      add_timer_on( &pInstance->timer, cpu );
+   }
+   else
+   {
+      timer_setup( &pInstance->timer, onMyTimer, 0 );
+      mod_timer( &pInstance->timer, deadlineToJiffies( pInstance->deadline ) );
+   }
+   cpus_read_unlock();
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Starts the timer of the given instance with its current period
+ *        by the engine selected in pInstance->mode.
+ *
+ * All deadlines are multiples of the period counted from the epoch.
+ * @see getEpoch()
+ * @note The timer has to be stopped before and oMutex has to be held.
+ */
+static void startTimer( INSTANCE_T* pInstance )
+{
+   pageWriteBegin( pInstance->pPage );
+   WRITE_ONCE( pInstance->pPage->period, pInstance->period );
+   pageWriteEnd( pInstance->pPage );
+
+   if( pInstance->period == 0 )
+   {
+      DEBUG_MESSAGE( "timer%d suspended\n", pInstance->minor  );
+      return;
+   }
+
+   DEBUG_MESSAGE( "new period for timer%d: %llu ns, mode: %s\n",
+                  pInstance->minor, pInstance->period,
+                  (pInstance->mode == TIMER_MODE_HRTIMER)? "hrtimer" : "jiffies" );
+
+   u64 now = ktime_get_ns();
+   pInstance->epoch = getEpoch( pInstance, now );
+   /*
+    * First deadline is the next multiple of the period after now.
+    */
+   pInstance->deadline = pInstance->epoch +
+                         (div64_u64( now - pInstance->epoch, pInstance->period ) + 1) *
+                         pInstance->period;
+
+   armTimer( pInstance );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Stops the timer of the given instance and waits till a possibly
+ *        running callback function has been finished.
+ */
+static void stopTimer( INSTANCE_T* pInstance )
+{
+   del_timer_sync( &pInstance->timer );
+   hrtimer_cancel( &pInstance->hrTimer );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Converts a period given as text into nanoseconds.
+ *
+ * The text is a decimal number followed by a optional unit
+ * "ms", "us" or "ns". Without unit the number means milliseconds,
+ * which keeps the interface compatible with former versions.
+ */
+static int parsePeriod( char* pText, u64* pPeriod )
+{
+   char* pUnit;
+   char  save;
+   u64   multiplier = NSEC_PER_MSEC;
+   int   ret;
+
+   pText = strim( pText );
+   pUnit = pText;
+   while( isdigit( *pUnit ) )
+      pUnit++;
+
+   if( pUnit == pText )
+      return -EINVAL;
+
+   if( *pUnit != '\0' )
+   {
+      if( strcmp( pUnit, "ms" ) == 0 )
+         multiplier = NSEC_PER_MSEC;
+      else if( strcmp( pUnit, "us" ) == 0 )
+         multiplier = NSEC_PER_USEC;
+      else if( strcmp( pUnit, "ns" ) == 0 )
+         multiplier = 1;
+      else
+         return -EINVAL;
+   }
+
+   save = *pUnit;
+   *pUnit = '\0';
+   ret = kstrtoull( pText, 10, pPeriod );
+   *pUnit = save;
+   if( ret < 0 )
+      return ret;
+
+   if( *pPeriod > div64_u64( U64_MAX, multiplier ) )
+      return -ERANGE;
+
+   *pPeriod *= multiplier;
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns -EINVAL when the period is shorter than minPeriod,
+ *        0 means suspended and is always valid.
+ */
+static int checkPeriod( u64 period )
+{
+   if( (period != 0) && (period < READ_ONCE( minPeriod )) )
+      return -EINVAL;
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Returns true when at least one instance has been expired since
+ *        its last read.
+ */
+static bool anyInstanceExpired( void )
+{
+   unsigned int minor;
+
+   for( minor = 0; minor < MAX_INSTANCES; minor++ )
+   {
+      if( atomic_read( &mg.instance[minor].count ) > 0 )
+         return true;
+   }
+   return false;
+}
+
+/****************** Private timers of a opened file **************************/
+
+/*!----------------------------------------------------------------------------
+ * @brief Callback function of a private timer.
+ * @note Runs in softirq context.
+ */
+static enum hrtimer_restart onPrivateTimer( struct hrtimer* pTimer )
+{
+   PRIVATE_TIMER_T* pPrivate = container_of( pTimer, PRIVATE_TIMER_T, hrTimer );
+   SESSION_T* pSession = pPrivate->pSession;
+   /*
+    * hrtimer_forward_now() advances from the previous expiry, so the
+    * period doesn't drift, and counts the missed periods as well.
+    */
+   u64 expirations = hrtimer_forward_now( pTimer, ns_to_ktime( pPrivate->period ) );
+
+   spin_lock( &pSession->readyLock );
+   if( pPrivate->expirations == 0 )
+      list_add_tail( &pPrivate->readyEntry, &pSession->readyList );
+   pPrivate->expirations += expirations;
+   spin_unlock( &pSession->readyLock );
+
+   if( wq_has_sleeper( &pSession->readyWaitQueue ) )
+      wake_up_interruptible( &pSession->readyWaitQueue );
+
+   return HRTIMER_RESTART;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Stops the private timer and removes it from the ready list.
+ */
+static void privateTimerStop( PRIVATE_TIMER_T* pPrivate )
+{
+   SESSION_T* pSession = pPrivate->pSession;
+
+   hrtimer_cancel( &pPrivate->hrTimer );
+
+   spin_lock_bh( &pSession->readyLock );
+   if( pPrivate->expirations != 0 )
+      list_del( &pPrivate->readyEntry );
+   pPrivate->expirations = 0;
+   spin_unlock_bh( &pSession->readyLock );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Starts the private timer, when its period isn't zero.
+ */
+static void privateTimerStart( PRIVATE_TIMER_T* pPrivate )
+{
+   if( pPrivate->period == 0 )
+      return;
+
+   hrtimer_start( &pPrivate->hrTimer, ns_to_ktime( pPrivate->period ),
+                  HRTIMER_MODE_REL_SOFT );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Implementation of TIMER_IOCTL_CREATE
+ */
+static long privateTimerCreate( SESSION_T* pSession, TIMER_PRIVATE_T __user* pArg )
+{
+   TIMER_PRIVATE_T  arg;
+   PRIVATE_TIMER_T* pPrivate;
+   int id;
+
+   if( copy_from_user( &arg, pArg, sizeof( arg ) ) != 0 )
+      return -EFAULT;
+
+   if( checkPeriod( arg.period ) != 0 )
+      return -EINVAL;
+
+   pPrivate = kzalloc( sizeof( PRIVATE_TIMER_T ), GFP_KERNEL );
+   if( pPrivate == NULL )
+      return -ENOMEM;
+
+   pPrivate->pSession = pSession;
+   pPrivate->period = arg.period;
+   INIT_LIST_HEAD( &pPrivate->readyEntry );
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+   hrtimer_setup( &pPrivate->hrTimer, onPrivateTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT );
+#else
+   hrtimer_init( &pPrivate->hrTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT );
+   pPrivate->hrTimer.function = onPrivateTimer;
+#endif
+
+   mutex_lock( &pSession->privateMutex );
+   if( pSession->numPrivateTimers >= READ_ONCE( maxPrivateTimers ) )
+   {
+      mutex_unlock( &pSession->privateMutex );
+      kfree( pPrivate );
+      return -EMFILE;
+   }
+
+   id = idr_alloc( &pSession->privateTimers, pPrivate, 0, 0, GFP_KERNEL );
+   if( id < 0 )
+   {
+      mutex_unlock( &pSession->privateMutex );
+      kfree( pPrivate );
+      return id;
+   }
+   pPrivate->id = id;
+   pSession->numPrivateTimers++;
+
+   arg.id = id;
+   if( copy_to_user( pArg, &arg, sizeof( arg ) ) != 0 )
+   {
+      idr_remove( &pSession->privateTimers, id );
+      pSession->numPrivateTimers--;
+      mutex_unlock( &pSession->privateMutex );
+      kfree( pPrivate );
+      return -EFAULT;
+   }
+
+   privateTimerStart( pPrivate );
+   mutex_unlock( &pSession->privateMutex );
+
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Implementation of TIMER_IOCTL_DELETE
+ */
+static long privateTimerDelete( SESSION_T* pSession, u32 __user* pArg )
+{
+   PRIVATE_TIMER_T* pPrivate;
+   u32 id;
+
+   if( get_user( id, pArg ) != 0 )
+      return -EFAULT;
+
+   mutex_lock( &pSession->privateMutex );
+   pPrivate = idr_remove( &pSession->privateTimers, id );
+   if( pPrivate == NULL )
+   {
+      mutex_unlock( &pSession->privateMutex );
+      return -ENOENT;
+   }
+   pSession->numPrivateTimers--;
+   privateTimerStop( pPrivate );
+   mutex_unlock( &pSession->privateMutex );
+
+   kfree( pPrivate );
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Implementation of TIMER_IOCTL_SET_PERIOD
+ */
+static long privateTimerSetPeriod( SESSION_T* pSession, TIMER_PRIVATE_T __user* pArg )
+{
+   TIMER_PRIVATE_T  arg;
+   PRIVATE_TIMER_T* pPrivate;
+
+   if( copy_from_user( &arg, pArg, sizeof( arg ) ) != 0 )
+      return -EFAULT;
+
+   if( checkPeriod( arg.period ) != 0 )
+      return -EINVAL;
+
+   mutex_lock( &pSession->privateMutex );
+   pPrivate = idr_find( &pSession->privateTimers, arg.id );
+   if( pPrivate == NULL )
+   {
+      mutex_unlock( &pSession->privateMutex );
+      return -ENOENT;
+   }
+   privateTimerStop( pPrivate );
+   pPrivate->period = arg.period;
+   privateTimerStart( pPrivate );
+   mutex_unlock( &pSession->privateMutex );
+
+   return 0;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Maximum number of events which becomes fetched by one call of
+ *        TIMER_IOCTL_GET_EVENTS, limits the size of the temporary buffer.
+ */
+#define MAX_EVENTS_PER_CALL 256
+
+/*!----------------------------------------------------------------------------
+ * @brief Implementation of TIMER_IOCTL_GET_EVENTS
+ */
+static long privateTimerGetEvents( struct file* pFile,
+                                   SESSION_T* pSession,
+                                   TIMER_EVENTS_T __user* pArg )
+{
+   TIMER_EVENTS_T arg;
+   TIMER_EVENT_T* pEvents;
+   PRIVATE_TIMER_T* pPrivate;
+   unsigned int count = 0;
+   long ret = 0;
+
+   if( copy_from_user( &arg, pArg, sizeof( arg ) ) != 0 )
+      return -EFAULT;
+
+   if( arg.capacity == 0 )
+      return -EINVAL;
+
+   arg.capacity = min_t( u32, arg.capacity, MAX_EVENTS_PER_CALL );
+   pEvents = kmalloc_array( arg.capacity, sizeof( TIMER_EVENT_T ), GFP_KERNEL );
+   if( pEvents == NULL )
+      return -ENOMEM;
+
+   /*
+    * privateMutex keeps the fetched timers alive till the events have
+    * been copied, a concurrent caller can take the events between the
+    * wake up and the fetch, so it becomes repeated till count > 0.
+    */
+   for( ;; )
+   {
+      if( mutex_lock_interruptible( &pSession->privateMutex ) != 0 )
+      {
+         ret = -ERESTARTSYS;
+         goto L_FREE;
+      }
+
+      spin_lock_bh( &pSession->readyLock );
+      while( (count < arg.capacity) && !list_empty( &pSession->readyList ) )
+      {
+         pPrivate = list_first_entry( &pSession->readyList, PRIVATE_TIMER_T, readyEntry );
+         list_del( &pPrivate->readyEntry );
+         pEvents[count].id = pPrivate->id;
+         pEvents[count].reserved = 0;
+         pEvents[count].expirations = pPrivate->expirations;
+         pPrivate->expirations = 0;
+         count++;
+      }
+      spin_unlock_bh( &pSession->readyLock );
+
+      if( count > 0 )
+         break;
+
+      mutex_unlock( &pSession->privateMutex );
+      if( pFile->f_flags & O_NONBLOCK )
+      {
+         ret = -EAGAIN;
+         goto L_FREE;
+      }
+      if( wait_event_interruptible( pSession->readyWaitQueue,
+                                    !list_empty_careful( &pSession->readyList ) ) != 0 )
+      {
+         ret = -ERESTARTSYS;
+         goto L_FREE;
+      }
+   }
+
+   arg.count = count;
+   if( (copy_to_user( u64_to_user_ptr( arg.events ), pEvents,
+                      count * sizeof( TIMER_EVENT_T ) ) != 0) ||
+       (put_user( arg.count, &pArg->count ) != 0) )
+   {
+      /*
+       * Gives the expirations back, so they aren't lost.
+       */
+      unsigned int i;
+
+      spin_lock_bh( &pSession->readyLock );
+      for( i = 0; i < count; i++ )
+      {
+         pPrivate = idr_find( &pSession->privateTimers, pEvents[i].id );
+         if( pPrivate->expirations == 0 )
+            list_add_tail( &pPrivate->readyEntry, &pSession->readyList );
+         pPrivate->expirations += pEvents[i].expirations;
+      }
+      spin_unlock_bh( &pSession->readyLock );
+      ret = -EFAULT;
+   }
+   mutex_unlock( &pSession->privateMutex );
+
+L_FREE:
+   kfree( pEvents );
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Destroys all private timers of the session when the file becomes
+ *        closed.
+ */
+static void privateTimersDestroy( SESSION_T* pSession )
+{
+   PRIVATE_TIMER_T* pPrivate;
+   int id;
+
+   idr_for_each_entry( &pSession->privateTimers, pPrivate, id )
+   {
+      privateTimerStop( pPrivate );
+      kfree( pPrivate );
+   }
+   idr_destroy( &pSession->privateTimers );
+   pSession->numPrivateTimers = 0;
+}
+
+/****************** End private timers of a opened file **********************/
+
+/*!----------------------------------------------------------------------------
+ * @brief
+ */
+static unsigned int onPoll( struct file* pFile, poll_table* pPollTable )
+{
+   unsigned int ret = 0;
+   SESSION_T* pSession = (SESSION_T*)pFile->private_data;
+   INSTANCE_T* pInstance = pSession->pInstance;
+   BUG_ON( pInstance == NULL );
+   DEBUG_MESSAGE( ": Minor-number: %d\n", pInstance->minor );
+
+   poll_wait( pFile, &pSession->readyWaitQueue, pPollTable );
+   if( pSession->format == TIMER_FORMAT_ALL )
+   {
+      poll_wait( pFile, &mg.anyWaitQueue, pPollTable );
+      if( anyInstanceExpired() )
+         ret |= (POLLIN | POLLRDNORM);
+   }
+   else if( pSession->format == TIMER_FORMAT_SAMPLES )
+   {
+      poll_wait( pFile, &pInstance->readWaitQueue, pPollTable );
+      if( sampleLevel( &pInstance->samples ) > 0 )
+         ret |= (POLLIN | POLLRDNORM);
+   }
+   else
+   {
+      poll_wait( pFile, &pInstance->readWaitQueue, pPollTable );
+      if( atomic_read( &pInstance->count ) > 0 )
+         ret |= (POLLIN | POLLRDNORM);
+   }
+   if( !list_empty_careful( &pSession->readyList ) )
+      ret |= (POLLIN | POLLRDNORM);
+
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Read in format TIMER_FORMAT_TEXT: tick count as decimal text.
+ */
+static ssize_t readText( INSTANCE_T* pInstance,
+                         char __user* pUserBuffer,
+                         size_t userCapacity,
+                         loff_t* pOffset )
+{
+   char textBuffer[32];
+   ssize_t ret = 0;
+   ssize_t remaining = 0;
+
+   ret = scnprintf( textBuffer,
+                    min( sizeof( textBuffer ),
+                         userCapacity),
+                    "%u", (unsigned int)atomic_xchg( &pInstance->count, 0 ) );
+   atomic_set( &pInstance->overruns, 0 );
+
+   remaining = copy_to_user( pUserBuffer, textBuffer, ret );
+   if( remaining < 0 )
+      return -EFAULT;
+
+   *pOffset = ret;
+   return ret;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Read in format TIMER_FORMAT_BINARY: TIMER_READ_T, the first
+ *        8 bytes behave like a read from a timerfd.
+ */
+static ssize_t readBinary( struct file* pFile,
+                           INSTANCE_T* pInstance,
+                           char __user* pUserBuffer,
+                           size_t userCapacity )
+{
+   TIMER_READ_T data;
+
+   if( userCapacity < sizeof( data.expirations ) )
+      return -EINVAL;
+
+   /*
+    * A concurrent reader can take the expirations between the wake up
+    * and the exchange, a timerfd compatible read never returns 0.
+    */
+   while( (data.expirations = (unsigned int)atomic_xchg( &pInstance->count, 0 )) == 0 )
+   {
+      if( pFile->f_flags & O_NONBLOCK )
+         return -EAGAIN;
+      if( wait_event_interruptible( pInstance->readWaitQueue,
+                                    (atomic_read( &pInstance->count ) > 0) ) != 0 )
+         return -ERESTARTSYS;
+   }
+
+   data.overruns    = (unsigned int)atomic_xchg( &pInstance->overruns, 0 );
+   data.lastExpiry  = atomic64_read( &pInstance->lastExpiry );
+
+   userCapacity = min( userCapacity, sizeof( data ) );
+   if( copy_to_user( pUserBuffer, &data, userCapacity ) != 0 )
+      return -EFAULT;
+
+   return userCapacity;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Read in format TIMER_FORMAT_ALL: one __u64 count per instance.
+ */
+static ssize_t readAll( struct file* pFile,
+                        char __user* pUserBuffer,
+                        size_t userCapacity )
+{
+   __u64 counts[MAX_INSTANCES];
+   unsigned int minor;
+   bool expired;
+
+   /*
+    * A read of a part of the instances would leave the others expired,
+    * so poll() would report POLLIN forever.
+    */
+   if( userCapacity < sizeof( counts ) )
+      return -EINVAL;
+
+   /*
+    * A concurrent reader can take the counts between the wake up and
+    * the exchange, so it becomes repeated till any count isn't zero.
+    */
+   for( ;; )
+   {
+      expired = false;
+      for( minor = 0; minor < MAX_INSTANCES; minor++ )
+      {
+         counts[minor] = (unsigned int)atomic_xchg( &mg.instance[minor].count, 0 );
+         atomic_set( &mg.instance[minor].overruns, 0 );
+         if( counts[minor] != 0 )
+            expired = true;
+      }
+      if( expired )
+         break;
+      if( pFile->f_flags & O_NONBLOCK )
+         return -EAGAIN;
+      if( wait_event_interruptible( mg.anyWaitQueue, anyInstanceExpired() ) != 0 )
+         return -ERESTARTSYS;
+   }
+
+   if( copy_to_user( pUserBuffer, counts, sizeof( counts ) ) != 0 )
+      return -EFAULT;
+
+   return sizeof( counts );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Read in format TIMER_FORMAT_SAMPLES: drains as many complete
+ *        sample records as fit into the user buffer.
+ * @note Consumer side of the ring.
+ */
+static ssize_t readSamples( struct file* pFile,
+                            INSTANCE_T* pInstance,
+                            char __user* pUserBuffer,
+                            size_t userCapacity )
+{
+   SAMPLE_RING_T* pRing = &pInstance->samples;
+   unsigned int tail;
+   unsigned int n;
+   unsigned int first;
+
+   if( userCapacity < sizeof( TIMER_SAMPLE_T ) )
+      return -EINVAL;
+
+   if( mutex_lock_interruptible( &pRing->readMutex ) != 0 )
+      return -ERESTARTSYS;
+
+   while( (n = sampleLevel( pRing )) == 0 )
+   {
+      mutex_unlock( &pRing->readMutex );
+      if( pFile->f_flags & O_NONBLOCK )
+         return -EAGAIN;
+      if( wait_event_interruptible( pInstance->readWaitQueue,
+                                    (sampleLevel( pRing ) > 0) ) != 0 )
+         return -ERESTARTSYS;
+      if( mutex_lock_interruptible( &pRing->readMutex ) != 0 )
+         return -ERESTARTSYS;
+   }
+
+   tail  = pRing->tail;
+   n     = min_t( size_t, n, userCapacity / sizeof( TIMER_SAMPLE_T ) );
+   first = min( n, pRing->mask + 1 - (tail & pRing->mask) );
+
+   if( copy_to_user( pUserBuffer, &pRing->pBuffer[tail & pRing->mask],
+                     first * sizeof( TIMER_SAMPLE_T ) ) != 0 ||
+       copy_to_user( pUserBuffer + first * sizeof( TIMER_SAMPLE_T ), pRing->pBuffer,
+                     (n - first) * sizeof( TIMER_SAMPLE_T ) ) != 0 )
+   {
+      mutex_unlock( &pRing->readMutex );
+      return -EFAULT;
+   }
+
+   /*
+    * Releases the records to the producer.
+    */
+   smp_store_release( &pRing->tail, tail + n );
+   mutex_unlock( &pRing->readMutex );
+
+   return n * sizeof( TIMER_SAMPLE_T );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief
+ */
+static ssize_t onRead( struct file* pFile,   /*!< @see include/linux/fs.h   */
+                       char __user* pUserBuffer, /*!< buffer to fill with data */
+                       size_t userCapacity,      /*!< maximum size to copy     */
+                       loff_t* pOffset )         /*!< pointer to the already copied bytes */
+{
+   SESSION_T* pSession = (SESSION_T*)pFile->private_data;
+   DEBUG_MESSAGE( ": Minor-number: %d\n", pSession->pInstance->minor );
+
+   if( pSession->format == TIMER_FORMAT_BINARY )
+      return readBinary( pFile, pSession->pInstance, pUserBuffer, userCapacity );
+
+   if( pSession->format == TIMER_FORMAT_ALL )
+      return readAll( pFile, pUserBuffer, userCapacity );
+
+   if( pSession->format == TIMER_FORMAT_SAMPLES )
+      return readSamples( pFile, pSession->pInstance, pUserBuffer, userCapacity );
+
+   return readText( pSession->pInstance, pUserBuffer, userCapacity, pOffset );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief
+ */
+static ssize_t onWrite( struct file *pFile,
+                        const char __user* pUserBuffer,
+                        size_t len,
+                        loff_t* pOffset )
+{
+   size_t n;
+   char  tmp[256];
+   INSTANCE_T* pInstance;
+   u64 period;
+   int ret;
+
+   memset( tmp, 0, sizeof(tmp) );
+   n = min( ARRAY_SIZE( tmp )-1, len );
+
+   pInstance = ((SESSION_T*)pFile->private_data)->pInstance;
+
+   DEBUG_MESSAGE( ": Minor-number: %d\n", pInstance->minor);
+   if( copy_from_user( tmp, pUserBuffer, n ) != 0 )
+   {
+      ERROR_MESSAGE( "copy_from_user\n" );
+      return -EFAULT;
+   }
+
+   ret = parsePeriod( tmp, &period );
+   if( ret < 0 )
+      return ret;
+
+   ret = checkPeriod( period );
+   if( ret < 0 )
+      return ret;
+
+   mutex_lock( &pInstance->oMutex );
+   stopTimer( pInstance );
+   atomic_set( &pInstance->count, 0 );
+   atomic_set( &pInstance->overruns, 0 );
+   pInstance->period = period;
+   startTimer( pInstance );
+   mutex_unlock( &pInstance->oMutex );
+
+   return n;
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Callback function becomes invoked by the function mmap() from the
+ *        user-space.
+ *
+ * Maps the page TIMER_PAGE_T of the instance read-only, so a consumer can
+ * observe the ticks without any system call.
+ */
+static int onMmap( struct file* pFile, struct vm_area_struct* pVma )
+{
+   INSTANCE_T* pInstance = ((SESSION_T*)pFile->private_data)->pInstance;
+
+   DEBUG_MESSAGE( ": Minor-number: %d\n", pInstance->minor );
+
+   if( (pVma->vm_pgoff != 0) || ((pVma->vm_end - pVma->vm_start) > PAGE_SIZE) )
+      return -EINVAL;
+
+   if( (pVma->vm_flags & VM_WRITE) != 0 )
+      return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+   vm_flags_clear( pVma, VM_MAYWRITE );
+#else
+   pVma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+   return vm_insert_page( pVma, pVma->vm_start, virt_to_page( pInstance->pPage ) );
+}
+
+/*!----------------------------------------------------------------------------
+ * @brief Callback function becomes invoked by the function ioctl() from the
+ *        user-space.
+ * @see timer_ctl.h
+ */
+static long onIoctl( struct file* pFile, unsigned int cmd, unsigned long arg )
+{
+   SESSION_T* pSession = (SESSION_T*)pFile->private_data;
+   unsigned int format;
+
+   DEBUG_MESSAGE( ": cmd = 0x%08X\n", cmd );
+
+   switch( cmd )
+   {
+      case TIMER_IOCTL_SET_FORMAT:
+      {
+         if( get_user( format, (unsigned int __user*)arg ) != 0 )
+            return -EFAULT;
+         if( format > TIMER_FORMAT_SAMPLES )
+            return -EINVAL;
+         if( format == TIMER_FORMAT_SAMPLES )
+         {
+            int ret;
+
+            if( pSession->pInstance->samples.pBuffer == NULL )
+               return -EOPNOTSUPP;
+            ret = sampleReset( &pSession->pInstance->samples );
+            if( ret < 0 )
+               return ret;
+         }
+         pSession->format = format;
+         return 0;
+      }
+      case TIMER_IOCTL_GET_FORMAT:
+      {
+         return put_user( pSession->format, (unsigned int __user*)arg );
+      }
+      case TIMER_IOCTL_CREATE:
+      {
+         return privateTimerCreate( pSession, (TIMER_PRIVATE_T __user*)arg );
+      }
+      case TIMER_IOCTL_DELETE:
+      {
+         return privateTimerDelete( pSession, (u32 __user*)arg );
+      }
+      case TIMER_IOCTL_SET_PERIOD:
+      {
+         return privateTimerSetPeriod( pSession, (TIMER_PRIVATE_T __user*)arg );
+      }
+      case TIMER_IOCTL_GET_EVENTS:
+      {
+         return privateTimerGetEvents( pFile, pSession, (TIMER_EVENTS_T __user*)arg );
+      }
+   }
+
+   return -ENOTTY;
+}
+
+static struct file_operations mg_fops =
+{
+  .owner          = THIS_MODULE,
+  .open           = onOpen,
+  .release        = onClose,
+  .read           = onRead,
+  .write          = onWrite,
+  .unlocked_ioctl = onIoctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+  .compat_ioctl   = compat_ptr_ioctl,
+#endif
+  .mmap           = onMmap,
+  .poll           = onPoll
+};
+
+/****************** Device attribut functions ********************************/
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/mode
+ */
+static ssize_t mode_show( struct device* pDev,
+                          struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%s\n",
+                   (pInstance->mode == TIMER_MODE_HRTIMER)? "hrtimer" : "jiffies" );
+}
+
+/*-----------------------------------------------------------------------------
+ * echo hrtimer > /sys/class/timer/timer[n]/mode
+ * echo jiffies > /sys/class/timer/timer[n]/mode
+ */
+static ssize_t mode_store( struct device* pDev,
+                           struct device_attribute* pAttr,
+                           const char* pBuf, size_t count )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+   TIMER_MODE_T mode;
+
+   if( sysfs_streq( pBuf, "hrtimer" ) )
+      mode = TIMER_MODE_HRTIMER;
+   else if( sysfs_streq( pBuf, "jiffies" ) )
+      mode = TIMER_MODE_JIFFIES;
+   else
+      return -EINVAL;
+
+   mutex_lock( &pInstance->oMutex );
+   if( pInstance->mode != mode )
+   {
+      stopTimer( pInstance );
+      pInstance->mode = mode;
+      startTimer( pInstance );
+   }
+   mutex_unlock( &pInstance->oMutex );
+
+   return count;
+}
+
+static DEVICE_ATTR_RW( mode );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/latency
+ * Output: <min> <max> <mean> <samples>, latencies in nanoseconds.
+ */
+static ssize_t latency_show( struct device* pDev,
+                             struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+   LATENCY_T latency;
+
+   latencyRead( pInstance, &latency );
+   if( latency.samples == 0 )
+      return sprintf( pBuf, "0 0 0 0\n" );
+
+   return sprintf( pBuf, "%llu %llu %llu %llu\n",
+                   latency.min, latency.max,
+                   div64_u64( latency.sum, latency.samples ),
+                   latency.samples );
+}
+
+static DEVICE_ATTR_RO( latency );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/histogram
+ * Output: One line per bucket: <lower limit in ns> <count>
+ */
+static ssize_t histogram_show( struct device* pDev,
+                               struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+   LATENCY_T latency;
+   ssize_t len = 0;
+   unsigned int i;
+
+   latencyRead( pInstance, &latency );
+   for( i = 0; i < LATENCY_HISTOGRAM_SIZE; i++ )
+   {
+      len += sysfs_emit_at( pBuf, len, "%llu %u\n",
+                            (i == 0)? 0ULL : (1ULL << (i - 1)),
+                            latency.histogram[i] );
+   }
+
+   return len;
+}
+
+static DEVICE_ATTR_RO( histogram );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/overruns
+ * Total number of missed periods since the start of the timer.
+ */
+static ssize_t overruns_show( struct device* pDev,
+                              struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%llu\n", READ_ONCE( pInstance->pPage->overruns ) );
+}
+
+static DEVICE_ATTR_RO( overruns );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/group
+ */
+static ssize_t group_show( struct device* pDev,
+                           struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%u\n", pInstance->group );
+}
+
+/*-----------------------------------------------------------------------------
+ * echo 1 > /sys/class/timer/timer[n]/group
+ * Puts the instance in group 1..MAX_GROUPS, 0 removes it from its group.
+ */
+static ssize_t group_store( struct device* pDev,
+                            struct device_attribute* pAttr,
+                            const char* pBuf, size_t count )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+   unsigned int group;
+
+   if( kstrtouint( pBuf, 10, &group ) != 0 )
+      return -EINVAL;
+   if( group > MAX_GROUPS )
+      return -ERANGE;
+
+   mutex_lock( &pInstance->oMutex );
+   if( pInstance->group != group )
+   {
+      stopTimer( pInstance );
+
+      mutex_lock( &mg.groupMutex );
+      if( pInstance->group != 0 )
+      {
+         GROUP_T* pOldGroup = &mg.group[pInstance->group - 1];
+         pOldGroup->members--;
+         if( pOldGroup->members == 0 )
+            pOldGroup->epoch = 0;
+      }
+      if( group != 0 )
+         mg.group[group - 1].members++;
+      pInstance->group = group;
+      mutex_unlock( &mg.groupMutex );
+
+      startTimer( pInstance );
+   }
+   mutex_unlock( &pInstance->oMutex );
+
+   return count;
+}
+
+static DEVICE_ATTR_RW( group );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/slack
+ */
+static ssize_t slack_show( struct device* pDev,
+                           struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%llu\n", pInstance->slack );
+}
+
+/*-----------------------------------------------------------------------------
+ * echo 50us > /sys/class/timer/timer[n]/slack
+ * Same syntax like the period, without unit the value means milliseconds.
+ */
+static ssize_t slack_store( struct device* pDev,
+                            struct device_attribute* pAttr,
+                            const char* pBuf, size_t count )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+   char  tmp[32];
+   u64   slack;
+   int   ret;
+
+   strscpy( tmp, pBuf, sizeof( tmp ) );
+   ret = parsePeriod( tmp, &slack );
+   if( ret < 0 )
+      return ret;
+
+   mutex_lock( &pInstance->oMutex );
+   stopTimer( pInstance );
+   pInstance->slack = slack;
+   startTimer( pInstance );
+   mutex_unlock( &pInstance->oMutex );
+
+   return count;
+}
+
+static DEVICE_ATTR_RW( slack );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/cpu
+ */
+static ssize_t cpu_show( struct device* pDev,
+                         struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%d\n", pInstance->cpu );
+}
+
+/*-----------------------------------------------------------------------------
+ * echo 3 > /sys/class/timer/timer[n]/cpu
+ * echo -1 > /sys/class/timer/timer[n]/cpu
+ * Pins the timer callback function, and therefore the wakeup of the readers,
+ * on the given CPU. -1 lets the kernel choose the CPU.
+ */
+static ssize_t cpu_store( struct device* pDev,
+                          struct device_attribute* pAttr,
+                          const char* pBuf, size_t count )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+   int cpu;
+   int ret;
+
+   ret = kstrtoint( pBuf, 10, &cpu );
+   if( ret < 0 )
+      return ret;
+
+   if( (cpu < -1) || (cpu >= (int)nr_cpu_ids) )
+      return -EINVAL;
+
+   if( (cpu >= 0) && !cpu_online( cpu ) )
+      return -ENODEV;
+
+   mutex_lock( &pInstance->oMutex );
+   stopTimer( pInstance );
+   pInstance->cpu = cpu;
+   startTimer( pInstance );
+   mutex_unlock( &pInstance->oMutex );
+
+   return count;
+}
+
+static DEVICE_ATTR_RW( cpu );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/sample_drops
+ * Number of sample records lost because the reader was too slow.
+ */
+static ssize_t sample_drops_show( struct device* pDev,
+                                  struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%u\n", atomic_read( &pInstance->samples.drops ) );
+}
+
+static DEVICE_ATTR_RO( sample_drops );
+
+static const char* mg_workerNames[] =
+{
+   [WORKER_NONE]      = "none",
+   [WORKER_KTHREAD]   = "kthread",
+   [WORKER_WORKQUEUE] = "workqueue"
+};
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/worker
+ */
+static ssize_t worker_show( struct device* pDev,
+                            struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%s\n", mg_workerNames[pInstance->worker] );
+}
+
+/*-----------------------------------------------------------------------------
+ * echo kthread > /sys/class/timer/timer[n]/worker
+ * echo workqueue > /sys/class/timer/timer[n]/worker
+ * echo none > /sys/class/timer/timer[n]/worker
+ * Selects the context in which the registered job runs after each tick.
+ */
+static ssize_t worker_store( struct device* pDev,
+                             struct device_attribute* pAttr,
+                             const char* pBuf, size_t count )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+   int worker;
+   int ret = 0;
+
+   worker = sysfs_match_string( mg_workerNames, pBuf );
+   if( worker < 0 )
+      return worker;
+
+   mutex_lock( &pInstance->oMutex );
+   if( pInstance->worker != worker )
+   {
+      stopTimer( pInstance );
+      ret = workerSetup( pInstance, worker );
+      startTimer( pInstance );
+   }
+   mutex_unlock( &pInstance->oMutex );
+
+   return (ret < 0)? ret : count;
+}
+
+static DEVICE_ATTR_RW( worker );
+
+/*-----------------------------------------------------------------------------
+ * cat /sys/class/timer/timer[n]/jobs
+ * Output: "runs misses max-delay", the delay is the time in nanoseconds
+ * from the deadline of the tick till the begin of its job.
+ */
+static ssize_t jobs_show( struct device* pDev,
+                          struct device_attribute* pAttr, char* pBuf )
+{
+   INSTANCE_T* pInstance = dev_get_drvdata( pDev );
+
+   return sprintf( pBuf, "%u %u %llu\n",
+                   atomic_read( &pInstance->jobRuns ),
+                   atomic_read( &pInstance->jobMisses ),
+                   (unsigned long long)atomic64_read( &pInstance->jobMaxDelay ) );
+}
+
+static DEVICE_ATTR_RO( jobs );
+
+static struct attribute* timer_attrs[] =
+{
+   &dev_attr_mode.attr,
+   &dev_attr_latency.attr,
+   &dev_attr_histogram.attr,
+   &dev_attr_overruns.attr,
+   &dev_attr_group.attr,
+   &dev_attr_slack.attr,
+   &dev_attr_cpu.attr,
+   &dev_attr_sample_drops.attr,
+   &dev_attr_worker.attr,
+   &dev_attr_jobs.attr,
+   NULL
+};
+
+ATTRIBUTE_GROUPS( timer );
+
+/****************** End device attribut functions ****************************/
+
+/****************** Debug file system ****************************************/
+
+/*-----------------------------------------------------------------------------
+ * echo 1 > /sys/kernel/debug/timer/timer[n]/reset
+ * Resets the latency statistic of the instance.
+ */
+static ssize_t onDebugResetWrite( struct file* pFile,
+                                  const char __user* pUserBuffer,
+                                  size_t len,
+                                  loff_t* pOffset )
+{
+   INSTANCE_T* pInstance = pFile->private_data;
+
+   mutex_lock( &pInstance->oMutex );
+   if( pInstance->period == 0 )
+   {  /*
+       * Timer is not running, so there is no concurrent writer.
+       */
+      latencyReset( pInstance );
+   }
+   else
+   {
+      atomic_set( &pInstance->latencyResetRequest, 1 );
+   }
+   mutex_unlock( &pInstance->oMutex );
+
+   return len;
+}
+
+static const struct file_operations mg_debugResetFops =
+{
+   .owner = THIS_MODULE,
+   .open  = simple_open,
+   .write = onDebugResetWrite
+};
+
+/****************** End debug file system ************************************/
+
+/*!----------------------------------------------------------------------------
+ * @brief Driver constructor
+ */
+static int __init driverInit( void )
+{
+   DEBUG_MESSAGE("\n");
+   unsigned int minor, currentMinor;
+
+
+   if( alloc_chrdev_region( &mg.deviceNumber, 0, MAX_INSTANCES, DEVICE_BASE_FILE_NAME ) < 0 )
+   {
+      ERROR_MESSAGE( "alloc_chrdev_region\n" );
+      return -EIO;
+   }
+
+   mg.pObject = cdev_alloc();
+   if( mg.pObject == NULL )
+   {
+      ERROR_MESSAGE( "cdev_alloc\n" );
+      goto L_DEVICE_NUMBER;
+   }
+
+   mg.pObject->owner = THIS_MODULE;
+   mg.pObject->ops = &mg_fops;
+   if( cdev_add( mg.pObject, mg.deviceNumber, MAX_INSTANCES ) )
+   {
+      ERROR_MESSAGE( "cdev_add\n" );
+      goto L_REMOVE_DEV;
+   }
+  /*!
+   * Register of the driver-instances visible in /sys/class/DEVICE_BASE_FILE_NAME
+   */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+   mg.pClass = class_create( DEVICE_BASE_FILE_NAME );
+#else
+   mg.pClass = class_create( THIS_MODULE, DEVICE_BASE_FILE_NAME );
+#endif
+   if( IS_ERR( mg.pClass ) )
+   {
+      ERROR_MESSAGE( "class_create: No udev support\n" );
+      goto L_CLASS_REMOVE;
+   }
+
+   mg.pWorkqueue = alloc_workqueue( DEVICE_BASE_FILE_NAME, WQ_UNBOUND | WQ_HIGHPRI, 0 );
+   if( mg.pWorkqueue == NULL )
+   {
+      ERROR_MESSAGE( "alloc_workqueue\n" );
+      goto L_CLASS_REMOVE;
+   }
+
+   mutex_init( &mg.groupMutex );
+   init_waitqueue_head( &mg.anyWaitQueue );
+   mutex_init( &mg.pluginMutex );
+   RCU_INIT_POINTER( mg.pSampler, NULL );
+   RCU_INIT_POINTER( mg.pJob, NULL );
+
+   if( sampleRingSize > MAX_SAMPLE_RING_SIZE )
+      sampleRingSize = MAX_SAMPLE_RING_SIZE;
+   if( sampleRingSize > 0 )
+      sampleRingSize = roundup_pow_of_two( sampleRingSize );
+
+   /*
+    * Errors of the debug file system are not fatal.
+    */
+   mg.pDebugDir = debugfs_create_dir( DEVICE_BASE_FILE_NAME, NULL );
+
+   for( minor = 0; minor < MAX_INSTANCES; minor++ )
+   {
+      currentMinor = minor;
+      INSTANCE_T* pInstance = &mg.instance[minor];
+
+      pInstance->pPage = (TIMER_PAGE_T*)get_zeroed_page( GFP_KERNEL );
+      if( pInstance->pPage == NULL )
+      {
+         ERROR_MESSAGE( "get_zeroed_page: " DEVICE_BASE_FILE_NAME "%d\n", minor );
+         goto L_INSTANCE_REMOVE;
+      }
+
+      if( sampleRingSize > 0 )
+      {
+         pInstance->samples.pBuffer = kvcalloc( sampleRingSize, sizeof( TIMER_SAMPLE_T ),
+                                                GFP_KERNEL );
+         if( pInstance->samples.pBuffer == NULL )
+         {
+            ERROR_MESSAGE( "kvcalloc: " DEVICE_BASE_FILE_NAME "%d\n", minor );
+            goto L_INSTANCE_REMOVE;
+         }
+         pInstance->samples.mask = sampleRingSize - 1;
+      }
+      pInstance->samples.head = 0;
+      pInstance->samples.tail = 0;
+      atomic_set( &pInstance->samples.drops, 0 );
+      mutex_init( &pInstance->samples.readMutex );
+
+      pInstance->minor = minor;
+      pInstance->mode = TIMER_MODE_JIFFIES;
+      pInstance->period = 0;
+      pInstance->group = 0;
+      pInstance->slack = 0;
+      pInstance->cpu = -1;
+      pInstance->worker = WORKER_NONE;
+      pInstance->pKthreadWorker = NULL;
+      kthread_init_work( &pInstance->kthreadWork, onKthreadWork );
+      INIT_WORK( &pInstance->work, onWork );
+      atomic64_set( &pInstance->jobDeadline, 0 );
+      atomic_set( &pInstance->jobRuns, 0 );
+      atomic_set( &pInstance->jobMisses, 0 );
+      atomic64_set( &pInstance->jobMaxDelay, 0 );
+
+      init_waitqueue_head( &pInstance->readWaitQueue );
+      mutex_init( &pInstance->oMutex );
+      timer_setup( &pInstance->timer, onMyTimer, 0 );
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+      hrtimer_setup( &pInstance->hrTimer, onMyHrTimer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT );
+#else
+      hrtimer_init( &pInstance->hrTimer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT );
+      pInstance->hrTimer.function = onMyHrTimer;
+#endif
+      atomic_set( &pInstance->count, 0 );
+      atomic_set( &pInstance->overruns, 0 );
+      atomic64_set( &pInstance->lastExpiry, 0 );
+      seqcount_init( &pInstance->latencySeq );
+      atomic_set( &pInstance->latencyResetRequest, 0 );
+      latencyReset( pInstance );
+
+      pInstance->pDev = device_create_with_groups( mg.pClass,
+                                                   NULL,
+                                                   mg.deviceNumber | minor,
+                                                   pInstance,
+                                                   timer_groups,
+                                                   DEVICE_BASE_FILE_NAME "%d",
+                                                   minor );
+      if( IS_ERR( pInstance->pDev ) )
+      {
+         ERROR_MESSAGE( "device_create: " DEVICE_BASE_FILE_NAME "%d\n", minor );
+         goto L_INSTANCE_REMOVE;
+      }
+
+      pInstance->pDebugDir = debugfs_create_dir( dev_name( pInstance->pDev ), mg.pDebugDir );
+      debugfs_create_file( "reset", 0200, pInstance->pDebugDir, pInstance, &mg_debugResetFops );
+   }
+
+   return 0;
+
+L_INSTANCE_REMOVE:
+   debugfs_remove_recursive( mg.pDebugDir );
+   for( minor = 0; minor < currentMinor; minor++ )
+      device_destroy( mg.pClass, mg.deviceNumber | minor );
+   for( minor = 0; minor < MAX_INSTANCES; minor++ )
+   {
+      free_page( (unsigned long)mg.instance[minor].pPage );
+      kvfree( mg.instance[minor].samples.pBuffer );
+   }
+   destroy_workqueue( mg.pWorkqueue );
 
 L_CLASS_REMOVE:
    class_destroy( mg.pClass );
@@ -318,11 +2300,16 @@ static void __exit driverExit( void )
     int minor;
     DEBUG_MESSAGE("\n");
 
+    debugfs_remove_recursive( mg.pDebugDir );
     for( minor = 0; minor < MAX_INSTANCES; minor++ )
     {
-       del_timer_sync( &mg.instance[minor].timer );
+       stopTimer( &mg.instance[minor] );
+       workerRelease( &mg.instance[minor] );
        device_destroy( mg.pClass, mg.deviceNumber | minor );
+       free_page( (unsigned long)mg.instance[minor].pPage );
+       kvfree( mg.instance[minor].samples.pBuffer );
     }
+    destroy_workqueue( mg.pWorkqueue );
     class_destroy( mg.pClass );
     cdev_del( mg.pObject );
     unregister_chrdev_region( mg.deviceNumber, MAX_INSTANCES );
@@ -0,0 +1,227 @@
+/*****************************************************************************/
+/*                                                                           */
+/*!  @brief Common header file for ioctl-commands and binary data formats   */
+/*!         of the timer driver /dev/timer[n]                                */
+/*                                                                           */
+/*---------------------------------------------------------------------------*/
+/*! @file    timer_ctl.h                                                     */
+/*! @author  Ulrich Becker                                                   */
+/*! @date    18.10.2026                                                      */
+/*****************************************************************************/
+#ifndef _TIMER_CTL_H
+#define _TIMER_CTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#ifndef __KERNEL__
+ #include <sys/ioctl.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+#define TIMER_BASE_NAME "timer"
+
+/*!
+ * @brief Read formats of a opened file, selectable by TIMER_IOCTL_SET_FORMAT.
+ */
+#define TIMER_FORMAT_TEXT   0 /*!< @brief Tick count as decimal text (default). */
+#define TIMER_FORMAT_BINARY 1 /*!< @brief Binary TIMER_READ_T, timerfd compatible. */
+/*!
+ * @brief Counts of all instances in one read.
+ *
+ * read() returns a packed array of __u64, one element per instance
+ * indexed by the minor number, each containing the expirations of this
+ * instance since its last read. The counts become reset by this read.
+ * The buffer has to hold the counts of all instances (one per device
+ * /dev/timer[n]), otherwise read() fails with EINVAL.
+ * The file becomes readable (POLLIN) when any instance has been expired.
+ * So a consumer of N instances needs only one select() and one read()
+ * instead of N reads.
+ */
+#define TIMER_FORMAT_ALL    2
+/*!
+ * @brief Stream of sample records.
+ *
+ * Each expiry appends a TIMER_SAMPLE_T into a ring buffer of the instance,
+ * read() returns as many complete records as fit into the buffer and
+ * removes them from the ring. So a reader which wakes up late gets each
+ * tick with its exact time instead of a collapsed count.
+ * Selecting this format discards the records of the instance from before
+ * and resets /sys/class/timer/timer[n]/sample_drops, so the stream starts
+ * without a gap. Therefore only one reader per instance should use it.
+ * @see TIMER_SAMPLE_T
+ */
+#define TIMER_FORMAT_SAMPLES 3
+
+/*!
+ * @brief Record returned by read() in the format TIMER_FORMAT_BINARY.
+ *
+ * The first 8 bytes are laid out like the data of a read() from a
+ * timerfd: the number of expirations since the last read in native
+ * byte order. So a read() with a buffer of 8 bytes behaves like a read()
+ * from a timerfd, including blocking respectively -EAGAIN when no
+ * expiration has occurred yet.
+ * A buffer of sizeof(TIMER_READ_T) bytes gets the complete record.
+ */
+typedef struct
+{
+   /*! @brief Number of expirations since the last read, including overruns. */
+   __u64 expirations;
+   /*! @brief CLOCK_MONOTONIC time of the last expiry in nanoseconds. */
+   __u64 lastExpiry;
+   /*! @brief Number of expirations since the last read which have been
+    *         missed because the callback came too late. */
+   __u64 overruns;
+} TIMER_READ_T;
+
+/*!
+ * @brief Layout of the read-only page which becomes mapped by mmap() of
+ *        /dev/timer[n], offset 0, length up to one page.
+ *
+ * The fields from ticks on are protected by sequence: the driver
+ * increments it before and after each update, so it is odd while a update
+ * is in progress. A reader has to retry when the sequence was odd or has
+ * changed during reading, @see timerPageRead().
+ */
+typedef struct
+{
+   /*! @brief Sequence counter, odd while the driver updates the page. */
+   __u32 sequence;
+   __u32 reserved;
+   /*! @brief Total number of expirations since the start of the timer,
+    *         becomes not reset by read(). */
+   __u64 ticks;
+   /*! @brief CLOCK_MONOTONIC time of the last expiry in nanoseconds. */
+   __u64 lastExpiry;
+   /*! @brief Period in nanoseconds, 0 means suspended. */
+   __u64 period;
+   /*! @brief Total number of missed periods since the start of the timer. */
+   __u64 overruns;
+} TIMER_PAGE_T;
+
+/*!
+ * @brief Record returned by read() in the format TIMER_FORMAT_SAMPLES.
+ */
+typedef struct
+{
+   /*! @brief Total number of expirations including this one, gaps mean
+    *         missed periods (overruns). */
+   __u64 sequence;
+   /*! @brief CLOCK_MONOTONIC time in nanoseconds of the scheduled expiry. */
+   __u64 deadline;
+   /*! @brief CLOCK_MONOTONIC time in nanoseconds when the callback ran. */
+   __u64 timestamp;
+   /*! @brief Value of a registered sample source, otherwise 0. */
+   __s64 value;
+} TIMER_SAMPLE_T;
+
+#ifndef __KERNEL__
+/*!
+ * @brief Makes a consistent copy of the mapped timer page without any
+ *        system call.
+ * @param pPage Pointer to the page mapped by mmap().
+ * @param pCopy Target of the copy.
+ */
+static inline void timerPageRead( const TIMER_PAGE_T* pPage, TIMER_PAGE_T* pCopy )
+{
+   __u32 sequence;
+   do
+   {
+      while( ((sequence = __atomic_load_n( &pPage->sequence, __ATOMIC_ACQUIRE )) & 1) != 0 )
+         ;
+      pCopy->ticks      = __atomic_load_n( &pPage->ticks, __ATOMIC_RELAXED );
+      pCopy->lastExpiry = __atomic_load_n( &pPage->lastExpiry, __ATOMIC_RELAXED );
+      pCopy->period     = __atomic_load_n( &pPage->period, __ATOMIC_RELAXED );
+      pCopy->overruns   = __atomic_load_n( &pPage->overruns, __ATOMIC_RELAXED );
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+   }
+   while( __atomic_load_n( &pPage->sequence, __ATOMIC_RELAXED ) != sequence );
+   pCopy->sequence = sequence;
+   pCopy->reserved = 0;
+}
+#endif
+
+#define TIMER_IOCTL_MAGIC 't'
+
+/*!
+ * @brief Selects the read format of the file, argument is a pointer to
+ *        a unsigned int containing TIMER_FORMAT_TEXT, TIMER_FORMAT_BINARY,
+ *        TIMER_FORMAT_ALL or TIMER_FORMAT_SAMPLES.
+ */
+#define TIMER_IOCTL_SET_FORMAT _IOW( TIMER_IOCTL_MAGIC, 1, unsigned int )
+
+/*!
+ * @brief Gets the current read format of the file.
+ */
+#define TIMER_IOCTL_GET_FORMAT _IOR( TIMER_IOCTL_MAGIC, 2, unsigned int )
+
+/*!
+ * @brief Argument of TIMER_IOCTL_CREATE and TIMER_IOCTL_SET_PERIOD.
+ */
+typedef struct
+{
+   /*! @brief Period in nanoseconds, 0 means suspended. A period shorter
+    *         than the module parameter minPeriod fails with EINVAL. */
+   __u64 period;
+   /*! @brief Identifier of the private timer, output of TIMER_IOCTL_CREATE. */
+   __u32 id;
+   __u32 reserved;
+} TIMER_PRIVATE_T;
+
+/*!
+ * @brief Expiration of a private timer reported by TIMER_IOCTL_GET_EVENTS.
+ */
+typedef struct
+{
+   /*! @brief Identifier of the private timer. */
+   __u32 id;
+   __u32 reserved;
+   /*! @brief Number of expirations since the last report of this timer. */
+   __u64 expirations;
+} TIMER_EVENT_T;
+
+/*!
+ * @brief Argument of TIMER_IOCTL_GET_EVENTS.
+ */
+typedef struct
+{
+   /*! @brief User-space address of a array of TIMER_EVENT_T. */
+   __u64 events;
+   /*! @brief Number of elements of the array. */
+   __u32 capacity;
+   /*! @brief Output: number of reported events. */
+   __u32 count;
+} TIMER_EVENTS_T;
+
+/*!
+ * @brief Creates a private timer of the opened file.
+ *
+ * Private timers are hosted by the opened file and become destroyed by
+ * close(). Like a timerfd, but thousands of them can share one file
+ * descriptor: poll() respectively select() reports POLLIN when the
+ * instance or at least one private timer has been expired.
+ */
+#define TIMER_IOCTL_CREATE     _IOWR( TIMER_IOCTL_MAGIC, 3, TIMER_PRIVATE_T )
+
+/*!
+ * @brief Destroys the private timer, argument is a pointer to its __u32 id.
+ */
+#define TIMER_IOCTL_DELETE     _IOW( TIMER_IOCTL_MAGIC, 4, __u32 )
+
+/*!
+ * @brief Changes the period of a private timer.
+ */
+#define TIMER_IOCTL_SET_PERIOD _IOW( TIMER_IOCTL_MAGIC, 5, TIMER_PRIVATE_T )
+
+/*!
+ * @brief Fetches the expired private timers and resets their expirations.
+ *
+ * Blocks when no private timer has been expired, unless the file has
+ * been opened with O_NONBLOCK, in this case it returns -EAGAIN.
+ * Returns at least one event on success. When the events can't be copied
+ * into the user buffer, they remain pending and it returns -EFAULT.
+ */
+#define TIMER_IOCTL_GET_EVENTS _IOWR( TIMER_IOCTL_MAGIC, 6, TIMER_EVENTS_T )
+
+#endif /* ifndef _TIMER_CTL_H */
+/*================================== EOF ====================================*/
@@ -0,0 +1,60 @@
+/*****************************************************************************/
+/*                                                                           */
+/*!  @brief Kernel interface for a pluggable job which the timer driver     */
+/*!         /dev/timer[n] runs deferred on each tick                         */
+/*                                                                           */
+/*---------------------------------------------------------------------------*/
+/*! @file    timer_job.h                                                     */
+/*! @author  Ulrich Becker                                                   */
+/*! @date    18.10.2026                                                      */
+/*****************************************************************************/
+#ifndef _TIMER_JOB_H
+#define _TIMER_JOB_H
+
+#ifndef __KERNEL__
+ #error This header is for kernel modules only!
+#endif
+
+#include <linux/types.h>
+
+/*!
+ * @brief Job which a other kernel module can register, so it becomes
+ *        invoked after each tick of the instances which have a worker.
+ * @see /sys/class/timer/timer[n]/worker
+ */
+typedef struct
+{
+   /*!
+    * @brief Body of the job.
+    * @param minor Instance which has been expired.
+    * @param deadline CLOCK_MONOTONIC time in nanoseconds of the expiry.
+    * @param pPrivate TIMER_JOB_T::pPrivate.
+    * @note Runs in process context of a kthread worker or a unbound
+    *       workqueue, so it may sleep. It never runs concurrently for the
+    *       same instance. A tick while run() is executing queues the job
+    *       again, so it becomes invoked once more directly after the
+    *       return. Only ticks while the job is still queued but not yet
+    *       started become counted as missed, the queued job gets the
+    *       deadline of the newest tick.
+    */
+   void (*run)( unsigned int minor, u64 deadline, void* pPrivate );
+   void* pPrivate;
+} TIMER_JOB_T;
+
+/*!
+ * @brief Registers the job for all timer instances.
+ * @retval 0 Success.
+ * @retval -EBUSY Another job is already registered.
+ */
+int timerRegisterJob( TIMER_JOB_T* pJob );
+
+/*!
+ * @brief Unregisters the job.
+ *
+ * When this function returns, run() is no longer running, so the
+ * module of the job can be removed.
+ */
+void timerUnregisterJob( TIMER_JOB_T* pJob );
+
+#endif /* ifndef _TIMER_JOB_H */
+/*================================== EOF ====================================*/
@@ -0,0 +1,54 @@
+/*****************************************************************************/
+/*                                                                           */
+/*!  @brief Kernel interface for a pluggable sample source of the timer     */
+/*!         driver /dev/timer[n]                                             */
+/*                                                                           */
+/*---------------------------------------------------------------------------*/
+/*! @file    timer_sampler.h                                                 */
+/*! @author  Ulrich Becker                                                   */
+/*! @date    18.10.2026                                                      */
+/*****************************************************************************/
+#ifndef _TIMER_SAMPLER_H
+#define _TIMER_SAMPLER_H
+
+#ifndef __KERNEL__
+ #error This header is for kernel modules only!
+#endif
+
+#include <linux/types.h>
+
+/*!
+ * @brief Sample source which a other kernel module can register, so
+ *        the value of each TIMER_SAMPLE_T becomes produced by it.
+ */
+typedef struct
+{
+   /*!
+    * @brief Returns the value of the sample of the given instance.
+    * @note Becomes invoked by the timer callback function in softirq
+    *       context, therefore it must not sleep and should be short.
+    */
+   s64 (*sample)( unsigned int minor, void* pPrivate );
+   /*!
+    * @brief Passed to sample() unchanged.
+    */
+   void* pPrivate;
+} TIMER_SAMPLER_T;
+
+/*!
+ * @brief Registers the sample source for all timer instances.
+ * @retval 0 Success.
+ * @retval -EBUSY Another sample source is already registered.
+ */
+int timerRegisterSampler( TIMER_SAMPLER_T* pSampler );
+
+/*!
+ * @brief Unregisters the sample source.
+ *
+ * When this function returns, sample() is no longer running, so the
+ * module of the sample source can be removed.
+ */
+void timerUnregisterSampler( TIMER_SAMPLER_T* pSampler );
+
+#endif /* ifndef _TIMER_SAMPLER_H */
+/*================================== EOF ====================================*/